@@ -0,0 +1,274 @@
+#include "archive.h"
+#include "elf_file.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const char ar_magic[] = "!<arch>\n";
+static const size_t ar_magic_size = 8;
+
+struct ar_header {
+	char name[16];
+	char date[12];
+	char uid[6];
+	char gid[6];
+	char mode[8];
+	char size[10];
+	char fmag[2];
+};
+
+static_assert(sizeof(ar_header) == 60, "Invalid size for ar_header");
+
+
+static void throw_ar_error(const std::string &msg = "invalid archive") {
+	throw std::runtime_error(msg);
+}
+
+static uint32_t read_be32(const uint8_t *p) {
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t read_be64(const uint8_t *p) {
+	return ((uint64_t)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+static uint32_t read_native32(const uint8_t *p) {
+	uint32_t x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+// space-padded decimal number.
+static bool parse_decimal(const char *cp, size_t length, size_t &rv) {
+	rv = 0;
+	size_t i = 0;
+	for (; i < length && cp[i] == ' '; ++i) ;
+	if (i == length) return false;
+	for (; i < length && cp[i] != ' '; ++i) {
+		if (cp[i] < '0' || cp[i] > '9') return false;
+		rv = rv * 10 + cp[i] - '0';
+	}
+	return true;
+}
+
+
+bool archive::is_archive(const uint8_t *data, size_t size) {
+	return size >= ar_magic_size && !memcmp(data, ar_magic, ar_magic_size);
+}
+
+
+archive::archive(int fd, const std::string &name) : _name(name) {
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) throw_errno("fstat");
+	if (!S_ISREG(st.st_mode)) throw_ar_error("not a regular file");
+
+	_size = st.st_size;
+	if (_size < ar_magic_size) throw_ar_error();
+
+	void *vp = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (vp != MAP_FAILED) {
+		size_t size = _size;
+		_map = std::shared_ptr<uint8_t>((uint8_t *)vp, [size](uint8_t *p){ munmap(p, size); });
+	} else {
+		std::shared_ptr<uint8_t> tmp(new uint8_t[_size], std::default_delete<uint8_t[]>());
+		size_t total = 0;
+		while (total < _size) {
+			ssize_t ok = pread(fd, tmp.get() + total, _size - total, total);
+			if (ok < 0) {
+				if (errno == EINTR) continue;
+				throw_errno("read");
+			}
+			if (ok == 0) throw_ar_error();
+			total += ok;
+		}
+		_map = std::move(tmp);
+	}
+
+	if (!is_archive(_map.get(), _size)) throw_ar_error();
+
+	read_index();
+}
+
+
+bool archive::read_member(size_t offset, member &m) const {
+
+	const uint8_t *base = _map.get();
+
+	if (offset >= _size) return false;
+	if (_size - offset < sizeof(ar_header)) throw_ar_error();
+
+	const ar_header &h = *(const ar_header *)(base + offset);
+	if (h.fmag[0] != '`' || h.fmag[1] != '\n') throw_ar_error();
+
+	size_t size;
+	if (!parse_decimal(h.size, sizeof(h.size), size)) throw_ar_error();
+
+	m.offset = offset + sizeof(ar_header);
+	if (size > _size - m.offset) throw_ar_error();
+	m.size = size;
+	m.next = m.offset + size + (size & 1);
+
+	std::string_view name(h.name, sizeof(h.name));
+	name = name.substr(0, name.find_last_not_of(' ') + 1);
+
+	if (name.substr(0, 3) == "#1/") {
+		// bsd - name follows the header.
+		size_t length;
+		if (!parse_decimal(h.name + 3, sizeof(h.name) - 3, length)) throw_ar_error();
+		if (length > m.size) throw_ar_error();
+		const char *cp = (const char *)base + m.offset;
+		m.name.assign(cp, strnlen(cp, length));
+		m.offset += length;
+		m.size -= length;
+		return true;
+	}
+
+	if (name.size() > 1 && name[0] == '/' && name[1] >= '0' && name[1] <= '9') {
+		// gnu - offset into the long name table.
+		size_t index;
+		if (!parse_decimal(h.name + 1, sizeof(h.name) - 1, index)) throw_ar_error();
+		if (index >= _long_names.size()) throw_ar_error();
+		auto tmp = _long_names.substr(index);
+		tmp = tmp.substr(0, tmp.find('\n'));
+		if (!tmp.empty() && tmp.back() == '/') tmp.remove_suffix(1);
+		m.name = tmp;
+		return true;
+	}
+
+	// special members (/, //, /SYM64/) keep their names.
+	if (name.size() > 1 && name.back() == '/' && name != "//" && name != "/SYM64/") name.remove_suffix(1);
+	m.name = name;
+	return true;
+}
+
+
+void archive::read_index() {
+
+	const uint8_t *base = _map.get();
+
+	bool have_index = false;
+	size_t offset = ar_magic_size;
+	member m;
+
+	// the index and long name table come before any regular members.
+	while (read_member(offset, m)) {
+		const uint8_t *data = base + m.offset;
+
+		if (m.name == "/" || m.name == "/SYM64/") {
+			bool is64 = m.name != "/";
+			size_t word = is64 ? 8 : 4;
+			auto read_word = [&](const uint8_t *p) -> uint64_t {
+				return is64 ? read_be64(p) : read_be32(p);
+			};
+
+			if (m.size < word) throw_ar_error();
+			uint64_t count = read_word(data);
+			if (count > (m.size - word) / word) throw_ar_error();
+
+			const uint8_t *offsets = data + word;
+			const char *cp = (const char *)(offsets + count * word);
+			const char *end = (const char *)data + m.size;
+
+			for (uint64_t i = 0; i < count; ++i) {
+				if (cp >= end) throw_ar_error();
+				size_t length = strnlen(cp, end - cp);
+				uint64_t tmp = read_word(offsets + i * word);
+				if (tmp <= UINT32_MAX)
+					_index.emplace(std::string_view(cp, length), (uint32_t)tmp);
+				cp += length + 1;
+			}
+			have_index = true;
+		} else if (m.name == "//") {
+			_long_names = std::string_view((const char *)data, m.size);
+		} else if (m.name == "__.SYMDEF" || m.name == "__.SYMDEF SORTED") {
+			// bsd ranlib: size, { strx, offset }[], size, strings
+			if (m.size < 8) throw_ar_error();
+			uint32_t ranlib_size = read_native32(data);
+			if (ranlib_size > m.size - 8) throw_ar_error();
+			uint32_t strings_size = read_native32(data + 4 + ranlib_size);
+			if (strings_size > m.size - 8 - ranlib_size) throw_ar_error();
+			const char *strings = (const char *)data + 8 + ranlib_size;
+
+			for (uint32_t i = 0; i + 8 <= ranlib_size; i += 8) {
+				uint32_t strx = read_native32(data + 4 + i);
+				uint32_t tmp = read_native32(data + 8 + i);
+				if (strx >= strings_size) throw_ar_error();
+				_index.emplace(std::string_view(strings + strx, strnlen(strings + strx, strings_size - strx)), tmp);
+			}
+			have_index = true;
+		} else {
+			break;
+		}
+		offset = m.next;
+	}
+
+	if (!have_index) build_index();
+}
+
+
+void archive::build_index() {
+
+	// no symbol index (ar without ranlib).  Build one from the members.
+	const uint8_t *base = _map.get();
+
+	size_t offset = ar_magic_size;
+	member m;
+	while (read_member(offset, m)) {
+		size_t header = offset;
+		offset = m.next;
+
+		if (m.size < sizeof(Elf32_Ehdr) || memcmp(base + m.offset, ELFMAG, SELFMAG)) continue;
+
+		try {
+			elf_file file(base + m.offset, m.size, _map);
+			auto sections = file.sections();
+			for (const auto &s : sections) {
+				if (s.sh_type != SHT_SYMTAB) continue;
+				if (s.sh_link >= sections.size()) continue;
+				const auto &st = sections[s.sh_link];
+				auto strings = file.strings(st);
+
+				// file may be a copy (misaligned or foreign-endian), so the
+				// names are taken from the same bytes in the map.
+				const char *first = (const char *)file.data(st).data();
+				const char *in_place = (const char *)base + m.offset + st.sh_offset;
+				for (const auto &sym : file.table<Elf32_Sym>(s)) {
+					if (ELF32_ST_BIND(sym.st_info) == STB_LOCAL) continue;
+					if (sym.st_shndx == SHN_UNDEF) continue;
+					if (!strings.valid(sym.st_name)) continue;
+					auto name = strings[sym.st_name];
+					_index.emplace(std::string_view(in_place + (name.data() - first), name.size()), header);
+				}
+			}
+		} catch (std::exception &) {
+			// reported if the member is ever loaded.
+		}
+	}
+}
+
+
+uint32_t archive::find(std::string_view symbol) const {
+	auto iter = _index.find(symbol);
+	return iter == _index.end() ? 0 : iter->second;
+}
+
+std::string archive::member_name(uint32_t offset) const {
+	member m;
+	if (!read_member(offset, m)) return std::string();
+	return m.name;
+}
+
+std::unique_ptr<elf_file> archive::open_member(uint32_t offset) const {
+	member m;
+	if (!read_member(offset, m)) throw_ar_error("bad member offset");
+	return std::unique_ptr<elf_file>(new elf_file(_map.get() + m.offset, m.size, _map));
+}
@@ -0,0 +1,64 @@
+#ifndef __archive_h__
+#define __archive_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class elf_file;
+
+/*
+ * ar archive (static library).  Only the symbol index is read when the
+ * archive is opened; members are located and parsed on demand.
+ *
+ * Supports the SysV/GNU (/ and /SYM64/) and BSD (__.SYMDEF) symbol
+ * indexes.  If there is no index, one is built from the members.
+ */
+class archive {
+
+	std::shared_ptr<uint8_t> _map;
+	size_t _size = 0;
+	std::string _name;
+
+	std::string_view _long_names;
+
+	// symbol -> offset of the member header.
+	std::unordered_map<std::string_view, uint32_t> _index; // names point into the map
+
+	struct member {
+		std::string name;
+		size_t offset = 0; // data offset
+		size_t size = 0;
+		size_t next = 0; // offset of the next header
+	};
+
+	bool read_member(size_t offset, member &m) const;
+	void read_index();
+	void build_index();
+
+public:
+
+	// fd may be closed once the constructor returns.
+	archive(int fd, const std::string &name);
+
+	archive(const archive &) = delete;
+	archive &operator=(const archive &) = delete;
+
+	const std::string &name() const { return _name; }
+
+	static bool is_archive(const uint8_t *data, size_t size);
+
+	// offset of the member that defines symbol, or 0.
+	uint32_t find(std::string_view symbol) const;
+
+	// name of the member at offset (for diagnostics).
+	std::string member_name(uint32_t offset) const;
+
+	std::unique_ptr<elf_file> open_member(uint32_t offset) const;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * symbol map microbenchmark: the link's name -> id table as a
+ * std::unordered_map<std::string, int> (as it was), keyed by hashed_name,
+ * and as a flat_name_map.
+ *
+ * The workload looks like pass 1.5 of the merge: file by file, look up
+ * (or add) each global the file defines or references.  Most references
+ * are to names which already exist.
+ *
+ * usage: name_map_bench [symbols [files]]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "flat_name_map.h"
+#include "string_pool.h"
+
+
+namespace {
+
+	typedef std::chrono::steady_clock clock_type;
+
+	struct workload {
+		std::vector<std::string> names;
+		std::vector<uint32_t> refs; // indexes into names, in merge order
+	};
+
+	workload make_workload(unsigned symbols, unsigned files) {
+		workload w;
+		std::mt19937 rng(65816);
+
+		w.names.reserve(symbols);
+		for (unsigned i = 0; i < symbols; ++i) {
+			static const char *prefixes[] = { "", "_", "__", "_O\x03.section" };
+			std::string name = prefixes[rng() % 4];
+			name += (rng() % 2) ? "func_" : "data_";
+			name += std::to_string(i);
+			name += "_";
+			name += std::to_string(rng() % 1000);
+			w.names.emplace_back(std::move(name));
+		}
+
+		// each file defines its share of the symbols and references 3x as
+		// many, mostly ones defined earlier.
+		unsigned per_file = symbols / files + 1;
+		unsigned defined = 0;
+		for (unsigned f = 0; f < files && defined < symbols; ++f) {
+			unsigned end = std::min(symbols, defined + per_file);
+			for (unsigned i = defined; i < end; ++i) w.refs.push_back(i);
+			for (unsigned i = 0; i < per_file * 3; ++i) w.refs.push_back(rng() % end);
+			defined = end;
+		}
+		return w;
+	}
+
+	// the names as they'd arrive from the mapped string tables.
+	std::vector<std::string_view> views(const workload &w) {
+		std::vector<std::string_view> rv;
+		rv.reserve(w.refs.size());
+		for (auto i : w.refs) rv.emplace_back(w.names[i]);
+		return rv;
+	}
+
+	template<class F>
+	double run(const char *label, unsigned repeat, size_t ops, F &&fn) {
+		double best = 0;
+		for (unsigned r = 0; r < repeat; ++r) {
+			auto start = clock_type::now();
+			fn();
+			double ns = std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+			if (!r || ns < best) best = ns;
+		}
+		printf("%-28s %8.1f ns/lookup %10.2f ms\n", label, best / ops, best / 1e6);
+		return best;
+	}
+}
+
+
+int main(int argc, char **argv) {
+
+	unsigned symbols = argc > 1 ? strtoul(argv[1], nullptr, 10) : 50000;
+	unsigned files = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2000;
+	const unsigned repeat = 5;
+
+	if (!symbols || !files) {
+		fprintf(stderr, "usage: name_map_bench [symbols [files]]\n");
+		return 1;
+	}
+
+	auto w = make_workload(symbols, files);
+	auto refs = views(w);
+	printf("%u symbols, %u files, %zu lookups\n", symbols, files, refs.size());
+
+	// ids, for checking the tables agree.
+	std::vector<int> expected(refs.size());
+	std::vector<int> actual(refs.size());
+
+	run("unordered_map<string>", repeat, refs.size(), [&](){
+		std::unordered_map<std::string, int> map;
+		int next = 0;
+		for (size_t i = 0; i < refs.size(); ++i) {
+			std::string name(refs[i]);
+			auto iter = map.find(name);
+			if (iter == map.end()) iter = map.emplace(name, ++next).first;
+			expected[i] = iter->second;
+		}
+	});
+
+	run("unordered_map<hashed_name>", repeat, refs.size(), [&](){
+		std::unordered_map<hashed_name, int, hashed_name_hash> map;
+		string_pool pool;
+		int next = 0;
+		for (size_t i = 0; i < refs.size(); ++i) {
+			hashed_name key(refs[i]);
+			auto iter = map.find(key);
+			if (iter == map.end()) {
+				key.name = pool.copy(key.name);
+				iter = map.emplace(key, ++next).first;
+			}
+			actual[i] = iter->second;
+		}
+	});
+	if (actual != expected) {
+		fprintf(stderr, "unordered_map<hashed_name> mismatch\n");
+		return 1;
+	}
+
+	run("flat_name_map", repeat, refs.size(), [&](){
+		flat_name_map map;
+		string_pool pool;
+		int next = 0;
+		for (size_t i = 0; i < refs.size(); ++i) {
+			hashed_name key(refs[i]);
+			int *id = map.find(key);
+			if (!id) {
+				key.name = pool.copy(key.name);
+				id = map.emplace(key, ++next).first;
+			}
+			actual[i] = *id;
+		}
+	});
+	if (actual != expected) {
+		fprintf(stderr, "flat_name_map mismatch\n");
+		return 1;
+	}
+
+	// lookups only, all hits (the table is built once).
+	{
+		flat_name_map flat;
+		std::unordered_map<std::string, int> map;
+		for (size_t i = 0; i < w.names.size(); ++i) {
+			flat.emplace(hashed_name(w.names[i]), i + 1);
+			map.emplace(w.names[i], i + 1);
+		}
+
+		size_t found = 0;
+		run("unordered_map<string> find", repeat, refs.size(), [&](){
+			for (auto name : refs) found += map.find(std::string(name))->second;
+		});
+		size_t found2 = 0;
+		run("flat_name_map find", repeat, refs.size(), [&](){
+			for (auto name : refs) found2 += *flat.find(hashed_name(name));
+		});
+		if (found != found2) {
+			fprintf(stderr, "flat_name_map find mismatch\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
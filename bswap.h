@@ -1,3 +1,19 @@
+#ifndef __bswap_h__
+#define __bswap_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "elf32.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define BSWAP_SSSE3 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BSWAP_NEON 1
+#endif
 
 #if 0
 uint8_t byteswap(uint8_t value) {
@@ -29,18 +45,18 @@ int64_t byteswap(int64_t value) {
 }
 #endif
 
-inline void bswap(int8_t) { }
-inline void bswap(uint8_t) { }
-inline void bswap(int16_t x) { x = __builtin_bswap16(x); }
-inline void bswap(uint16_t x) { x = __builtin_bswap16(x); }
-inline void bswap(int32_t x) { x = __builtin_bswap32(x); }
-inline void bswap(uint32_t x) { x = __builtin_bswap32(x); }
-inline void bswap(int64_t x) { x = __builtin_bswap64(x); }
-inline void bswap(uint64_t x) { x = __builtin_bswap64(x); }
+inline void bswap(int8_t &) { }
+inline void bswap(uint8_t &) { }
+inline void bswap(int16_t &x) { x = __builtin_bswap16(x); }
+inline void bswap(uint16_t &x) { x = __builtin_bswap16(x); }
+inline void bswap(int32_t &x) { x = __builtin_bswap32(x); }
+inline void bswap(uint32_t &x) { x = __builtin_bswap32(x); }
+inline void bswap(int64_t &x) { x = __builtin_bswap64(x); }
+inline void bswap(uint64_t &x) { x = __builtin_bswap64(x); }
 
 
 
-void bswap(Elf32_Ehdr &x) {
+inline void bswap(Elf32_Ehdr &x) {
 	bswap(x.e_type);
 	bswap(x.e_machine);
 	bswap(x.e_version);
@@ -56,7 +72,7 @@ void bswap(Elf32_Ehdr &x) {
 	bswap(x.e_shstrndx);
 }
 
-void bswap(Elf32_Shdr &x) {
+inline void bswap(Elf32_Shdr &x) {
 	bswap(x.sh_name);
 	bswap(x.sh_type);
 	bswap(x.sh_flags);
@@ -66,10 +82,10 @@ void bswap(Elf32_Shdr &x) {
 	bswap(x.sh_link);
 	bswap(x.sh_info);
 	bswap(x.sh_addralign);
-	bswap(x.sh_entsize);	
+	bswap(x.sh_entsize);
 }
 
-void bswap(Elf32_Sym &x) {
+inline void bswap(Elf32_Sym &x) {
 	bswap(x.st_name);
 	bswap(x.st_value);
 	bswap(x.st_size);
@@ -78,13 +94,102 @@ void bswap(Elf32_Sym &x) {
 	bswap(x.st_shndx);
 }
 
-void bswap(Elf32_Rel &x) {
+inline void bswap(Elf32_Rel &x) {
 	bswap(x.r_offset);
 	bswap(x.r_info);
 }
 
-void bswap(Elf32_Rela &x) {
+inline void bswap(Elf32_Rela &x) {
 	bswap(x.r_offset);
 	bswap(x.r_info);
 	bswap(x.r_addend);
 }
+
+
+/*
+ * Bulk conversion of whole tables.  Elf32_Shdr, Elf32_Rel and Elf32_Rela
+ * are all 32-bit words; Elf32_Sym is 3 words, 2 bytes and a half word, so
+ * exactly one 16-byte vector.  Either way, it's one byte shuffle per 16 bytes.
+ */
+namespace bswap_detail {
+
+	alignas(16) static const uint8_t word_mask[16] = {
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+	};
+	alignas(16) static const uint8_t sym_mask[16] = {
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 12, 13, 15, 14
+	};
+
+	inline void shuffle_scalar(uint8_t *p, size_t blocks, const uint8_t *mask) {
+		for (size_t i = 0; i < blocks; ++i, p += 16) {
+			uint8_t tmp[16];
+			memcpy(tmp, p, 16);
+			for (unsigned j = 0; j < 16; ++j) p[j] = tmp[mask[j]];
+		}
+	}
+
+#if BSWAP_SSSE3
+	__attribute__((target("ssse3")))
+	inline void shuffle_ssse3(uint8_t *p, size_t blocks, const uint8_t *mask) {
+		__m128i m = _mm_load_si128((const __m128i *)mask);
+		for (size_t i = 0; i < blocks; ++i, p += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			_mm_storeu_si128((__m128i *)p, _mm_shuffle_epi8(v, m));
+		}
+	}
+
+	inline bool have_ssse3() {
+		static const bool rv = __builtin_cpu_supports("ssse3");
+		return rv;
+	}
+#endif
+
+#if BSWAP_NEON
+	inline void shuffle_neon(uint8_t *p, size_t blocks, const uint8_t *mask) {
+		uint8x16_t m = vld1q_u8(mask);
+		for (size_t i = 0; i < blocks; ++i, p += 16) {
+			vst1q_u8(p, vqtbl1q_u8(vld1q_u8(p), m));
+		}
+	}
+#endif
+
+	inline void shuffle(uint8_t *p, size_t blocks, const uint8_t *mask) {
+#if BSWAP_SSSE3
+		if (have_ssse3()) return shuffle_ssse3(p, blocks, mask);
+#elif BSWAP_NEON
+		return shuffle_neon(p, blocks, mask);
+#endif
+		shuffle_scalar(p, blocks, mask);
+	}
+
+	inline void swap_words(void *vp, size_t words) {
+		uint8_t *p = (uint8_t *)vp;
+		shuffle(p, words / 4, word_mask);
+
+		p += (words & ~3) * 4;
+		for (size_t i = 0; i < (words & 3); ++i, p += 4) {
+			uint32_t x;
+			memcpy(&x, p, 4);
+			x = __builtin_bswap32(x);
+			memcpy(p, &x, 4);
+		}
+	}
+}
+
+inline void bswap(Elf32_Shdr *x, size_t count) {
+	bswap_detail::swap_words(x, count * sizeof(Elf32_Shdr) / 4);
+}
+
+inline void bswap(Elf32_Rel *x, size_t count) {
+	bswap_detail::swap_words(x, count * sizeof(Elf32_Rel) / 4);
+}
+
+inline void bswap(Elf32_Rela *x, size_t count) {
+	bswap_detail::swap_words(x, count * sizeof(Elf32_Rela) / 4);
+}
+
+inline void bswap(Elf32_Sym *x, size_t count) {
+	bswap_detail::shuffle((uint8_t *)x, count, bswap_detail::sym_mask);
+}
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * synthetic object generator for the parallel link check.
+ *
+ * Writes count little-endian EM_65816 ET_REL objects, o0000.o ...,
+ * into dir.  Each has code, read-only data, data and bss sections, a few
+ * local symbols, a function, a variable and an absolute symbol, and
+ * relocations (a mix of SHT_REL and SHT_RELA) against its own symbols
+ * and ones defined by other objects.  The output only depends on count,
+ * so every run links the same corpus.
+ *
+ * usage: make_objects dir [count]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "elf32.h"
+
+
+namespace {
+
+	struct section {
+		std::string name;
+		Elf32_Word type = 0;
+		Elf32_Word flags = 0;
+		std::vector<uint8_t> data;
+		Elf32_Word size = 0; // SHT_NOBITS
+		Elf32_Word link = 0;
+		Elf32_Word info = 0;
+		Elf32_Word align = 1;
+		Elf32_Word entsize = 0;
+	};
+
+	class string_table {
+		std::vector<uint8_t> _data{0};
+	public:
+		Elf32_Word add(const std::string &s) {
+			Elf32_Word rv = _data.size();
+			_data.insert(_data.end(), s.begin(), s.end());
+			_data.push_back(0);
+			return rv;
+		}
+		const std::vector<uint8_t> &data() const { return _data; }
+	};
+
+	template<class T>
+	void append(std::vector<uint8_t> &v, const T &x) {
+		const uint8_t *p = (const uint8_t *)&x;
+		v.insert(v.end(), p, p + sizeof(T));
+	}
+
+	std::vector<uint8_t> random_bytes(std::mt19937 &rng, unsigned lo, unsigned hi) {
+		std::vector<uint8_t> rv(lo + rng() % (hi - lo + 1));
+		for (auto &b : rv) b = rng();
+		return rv;
+	}
+
+	std::vector<uint8_t> make_object(unsigned index, unsigned count, std::mt19937 &rng) {
+
+		std::vector<section> sections(1);
+		string_table strings;
+
+		enum { code = 1, rodata, data, bss, symtab, rel, strtab };
+
+		{
+			auto &s = sections.emplace_back();
+			s.name = "code";
+			s.type = SHT_PROGBITS;
+			s.flags = SHF_ALLOC | SHF_EXECINSTR;
+			s.data = random_bytes(rng, 8, 60);
+		}
+		{
+			auto &s = sections.emplace_back();
+			s.name = "cdata";
+			s.type = SHT_PROGBITS;
+			s.flags = SHF_ALLOC;
+			s.data = random_bytes(rng, 0, 20);
+			s.align = 1 + rng() % 2;
+		}
+		{
+			auto &s = sections.emplace_back();
+			s.name = "data";
+			s.type = SHT_PROGBITS;
+			s.flags = SHF_ALLOC | SHF_WRITE;
+			s.data = random_bytes(rng, 1, 16);
+			s.align = 1 << (rng() % 3);
+		}
+		{
+			auto &s = sections.emplace_back();
+			s.name = "zdata";
+			s.type = SHT_NOBITS;
+			s.flags = SHF_ALLOC | SHF_WRITE;
+			s.size = rng() % 30;
+			s.align = 1 + rng() % 2;
+		}
+
+		const auto code_size = sections[code].data.size();
+
+		// symbols: null, locals, then globals.
+		std::vector<Elf32_Sym> symbols(1);
+		auto symbol = [&](const std::string &name, Elf32_Addr value, int bind, int type, int shndx){
+			Elf32_Sym x = {};
+			x.st_name = strings.add(name);
+			x.st_value = value;
+			x.st_info = ELF32_ST_INFO(bind, type);
+			x.st_shndx = shndx;
+			symbols.push_back(x);
+		};
+
+		for (unsigned i = 0; i < 3; ++i)
+			symbol("local" + std::to_string(index) + "_" + std::to_string(i),
+				rng() % code_size, STB_LOCAL, STT_NOTYPE, code);
+		unsigned locals = symbols.size();
+
+		symbol("func" + std::to_string(index), 0, STB_GLOBAL, STT_FUNC, code);
+		symbol("var" + std::to_string(index), 0, STB_GLOBAL, STT_OBJECT, data);
+		symbol("abs" + std::to_string(index), index * 3, STB_GLOBAL, STT_NOTYPE, SHN_ABS);
+		for (unsigned i = 0; i < 3; ++i) {
+			unsigned other = rng() % count;
+			if (other == index) continue;
+			symbol("func" + std::to_string(other), 0, STB_GLOBAL, STT_NOTYPE, SHN_UNDEF);
+			symbol("var" + std::to_string(other), 0, STB_GLOBAL, STT_NOTYPE, SHN_UNDEF);
+		}
+
+		// abs (2) and long (3) relocations into the code section.
+		bool rela = rng() % 2;
+		std::vector<uint8_t> relocs;
+		for (unsigned offset = 0; offset + 3 <= code_size; offset += 3 + rng() % 4) {
+			unsigned sym = 1 + rng() % (symbols.size() - 1);
+			unsigned type = rng() % 3 ? 2 : 3;
+			if (rela) {
+				Elf32_Rela r = {};
+				r.r_offset = offset;
+				r.r_info = ELF32_R_INFO(sym, type);
+				r.r_addend = rng() % 4;
+				append(relocs, r);
+			} else {
+				Elf32_Rel r = {};
+				r.r_offset = offset;
+				r.r_info = ELF32_R_INFO(sym, type);
+				append(relocs, r);
+			}
+		}
+
+		{
+			auto &s = sections.emplace_back();
+			s.name = ".symtab";
+			s.type = SHT_SYMTAB;
+			s.link = strtab;
+			s.info = locals;
+			s.align = 4;
+			s.entsize = sizeof(Elf32_Sym);
+			for (const auto &x : symbols) append(s.data, x);
+		}
+		{
+			auto &s = sections.emplace_back();
+			s.name = rela ? ".rela.code" : ".rel.code";
+			s.type = rela ? SHT_RELA : SHT_REL;
+			s.link = symtab;
+			s.info = code;
+			s.align = 4;
+			s.entsize = rela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+			s.data = std::move(relocs);
+		}
+
+		// .strtab doubles as the section name table.
+		std::vector<Elf32_Word> names;
+		for (auto &s : sections) names.push_back(s.name.empty() ? 0 : strings.add(s.name));
+		names.push_back(strings.add(".strtab"));
+		{
+			auto &s = sections.emplace_back();
+			s.type = SHT_STRTAB;
+			s.data = strings.data();
+		}
+
+		std::vector<uint8_t> out(sizeof(Elf32_Ehdr));
+		std::vector<Elf32_Shdr> headers(sections.size());
+		for (size_t i = 1; i < sections.size(); ++i) {
+			const auto &s = sections[i];
+			while (out.size() & 3) out.push_back(0);
+
+			auto &h = headers[i];
+			h.sh_name = names[i];
+			h.sh_type = s.type;
+			h.sh_flags = s.flags;
+			h.sh_offset = out.size();
+			h.sh_size = s.type == SHT_NOBITS ? s.size : s.data.size();
+			h.sh_link = s.link;
+			h.sh_info = s.info;
+			h.sh_addralign = s.align;
+			h.sh_entsize = s.entsize;
+			out.insert(out.end(), s.data.begin(), s.data.end());
+		}
+		while (out.size() & 3) out.push_back(0);
+
+		Elf32_Ehdr header = {};
+		memcpy(header.e_ident, ELFMAG, SELFMAG);
+		header.e_ident[EI_CLASS] = ELFCLASS32;
+		header.e_ident[EI_DATA] = ELFDATA2LSB;
+		header.e_ident[EI_VERSION] = EV_CURRENT;
+		header.e_type = ET_REL;
+		header.e_machine = EM_65816;
+		header.e_version = EV_CURRENT;
+		header.e_shoff = out.size();
+		header.e_ehsize = sizeof(Elf32_Ehdr);
+		header.e_shentsize = sizeof(Elf32_Shdr);
+		header.e_shnum = sections.size();
+		header.e_shstrndx = strtab;
+		memcpy(out.data(), &header, sizeof(header));
+
+		for (const auto &h : headers) append(out, h);
+		return out;
+	}
+}
+
+
+int main(int argc, char **argv) {
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: make_objects dir [count]\n");
+		return 1;
+	}
+
+	const char *dir = argv[1];
+	unsigned count = argc > 2 ? strtoul(argv[2], nullptr, 10) : 400;
+	if (!count) {
+		fprintf(stderr, "usage: make_objects dir [count]\n");
+		return 1;
+	}
+
+	mkdir(dir, 0777);
+
+	std::mt19937 rng(65816);
+	for (unsigned i = 0; i < count; ++i) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/o%04u.o", dir, i);
+
+		auto data = make_object(i, count, rng);
+		FILE *f = fopen(path, "wb");
+		if (!f || fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0) {
+			perror(path);
+			return 1;
+		}
+	}
+	return 0;
+}
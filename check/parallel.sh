@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# parallel link check: links a synthetic corpus serially (-j 1) and with
+# several worker counts, as an OMF file and as a -r partial link, and
+# fails unless every output and diagnostic is byte-identical.
+#
+# usage: check/parallel.sh [objects]
+#
+
+set -e
+
+here=$(dirname "$0")
+elf2omf=${ELF2OMF:-$here/../elf2omf}
+count=${1:-400}
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/elf2omf-check.XXXXXX")
+trap 'rm -rf "$tmp"' EXIT
+
+"$here/make_objects" "$tmp/obj" "$count"
+
+link() {
+	# $1 = jobs, $2 = output name, rest = extra flags
+	j=$1 out=$2
+	shift 2
+	"$elf2omf" -j "$j" "$@" -o "$tmp/$out" "$tmp"/obj/*.o > "$tmp/$out.log" 2>&1 \
+		|| echo "exit $?" >> "$tmp/$out.log"
+}
+
+link 1 serial.omf
+link 1 serial.o -r
+
+status=0
+for j in 2 4 16; do
+	link $j parallel.omf
+	link $j parallel.o -r
+	for f in omf omf.log o o.log; do
+		if ! cmp -s "$tmp/serial.$f" "$tmp/parallel.$f"; then
+			echo "-j $j: $f differs from -j 1" >&2
+			status=1
+		fi
+	done
+done
+
+if [ $status -eq 0 ]; then
+	echo "parallel check: $count objects, -j 2/4/16 match -j 1"
+fi
+exit $status
@@ -1,1245 +1,806 @@
 #include <algorithm>
-#include <iterator>
+#include <chrono>
+#include <memory>
 #include <numeric>
 #include <stdexcept>
 #include <string>
-#include <system_error>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <climits>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
 #include <err.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <sysexits.h>
 #include <unistd.h>
 
-
-#include "elf32.h"
-#include "omf.h"
-
-#ifdef __cpp_lib_endian
-#include <bit>
-using std::endian;
-#else
-#include "endian.h"
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
 #endif
 
-#include "bswap.h"
-
-static_assert(sizeof(Elf32_Ehdr) == 0x34, "Invalid size for Elf32_Ehdr");
-static_assert(sizeof(Elf32_Shdr) == 0x28, "Invalid size for Elf32_Shdr");
-static_assert(sizeof(Elf32_Sym) == 16, "Invalid size for Elf32_Sym");
-static_assert(sizeof(Elf32_Rel) == 8, "Invalid size for Elf32_Rel");
-static_assert(sizeof(Elf32_Rela) == 12, "Invalid size for Elf32_Rela");
-
-/*
-
-
- for now (small memory model - 1 segment)
- - merge all progbits
- - merge all bss
-
- - registers, tiny, ztiny merged together into direct page/stack segment
-
-put bss/ds at the end (could use )
-
-
-future
- - in omf, mark non-read-only segments as needing reload.
-
- */
-
-
-struct {
-	bool v = false;
-	bool S = false;
-	std::string o;
 
-//	std::vector<std::string> l;
-//	std::vector<std::string> L;
-
-	unsigned stack = 0;
-	unsigned errors = 0;
-	uint16_t file_type = 0;
-	uint32_t aux_type = 0;
-
-	unsigned omf_flags = 0;
+#include "elf32.h"
+#include "elf_file.h"
+#include "link_context.h"
+#include "omf.h"
+#include "server.h"
+#include "symbol_index.h"
+#include "worker_pool.h"
+
+
+struct : public link_options {
+	std::vector<std::string> l;
+	std::vector<std::string> L;
+	std::vector<std::string> d; // indexed object directories
+	std::vector<std::string> I; // directories to index
+	std::string s; // server socket
+	bool w = false; // watch
 } flags;
 
 
-struct reloc {
-	unsigned offset = 0;
-	unsigned value = 0;
-
-	int symbol = 0;
-	unsigned type = 0;
+// an input file named on the command line or in a manifest.
+struct input_spec {
+	std::string filename;
+	bool optional = false; // silently skipped if it doesn't exist
 };
 
+// resident server (-s): parsed objects kept between links, by absolute
+// path.  Each link runs in a forked child which reuses the objects that
+// haven't changed and reports the ones it had to parse, so the server can
+// parse them for next time.
+struct {
+	bool child = false;
+	int report_fd = -1;
+	resident_map objects;
+	std::vector<std::string> misses;
+} resident;
 
 
-struct symbol {
-	std::string name;
-	int id = 0;
-
-	// uint8_t type = 0;
-	// uint8_t flags = 0;
-	uint32_t offset = 0;
-	int section = 0;
-	unsigned count = 0; // number of references
-	bool local = false;
-	bool absolute = false;
-};
-
-enum {
-	TYPE_CODE = 1,
-	TYPE_DATA,
-	TYPE_CDATA,
-	TYPE_BSS
-};
-
-enum {
-	REGION_DP = 1,
-	REGION_NEAR,
-	REGION_FAR,
-	REGION_HUGE,
-};
-
-// this is our *merged* section, not an elf section
-struct section {
-	std::string name;
-	int id = 0;
-
-	uint32_t align = 0;
-
-	unsigned type = 0;
-	unsigned region = 0;
-
-
-	unsigned bss_size = 0;
-
-	std::vector<uint8_t> data;
-	std::vector<reloc> relocs;
-	// std::vector<unsigned> symbols;
+// find a -l library in the -L paths.  -l name looks for libname.a, then name.
+std::string find_library(const std::string &name) {
 
-	unsigned omf_segment = 0;
-	unsigned omf_offset = 0;
+	if (name.find('/') != name.npos) return name;
 
+	for (const auto &path : flags.L) {
+		std::string dir = path;
+		if (!dir.empty() && dir.back() != '/') dir.push_back('/');
 
-	unsigned size() const {
-		return type == TYPE_BSS ? bss_size : data.size();
+		for (const auto &tmp : { dir + "lib" + name + ".a", dir + name }) {
+			if (access(tmp.c_str(), R_OK) == 0) return tmp;
+		}
 	}
-
-};
-
-std::unordered_map<std::string, int> global_section_map;
-std::vector<section> global_sections;
-
-std::unordered_map<std::string, int> global_symbol_map;
-std::vector<symbol> global_symbols;
-
-void throw_errno(const std::string &msg) {
-	throw std::system_error(errno, std::generic_category(), msg); 
+	errx(1, "library not found: %s", name.c_str());
 }
 
-void throw_elf_error(const std::string &msg) {
-	throw std::runtime_error(msg);
-}
+bool parse_ft(const std::string &s, link_options &options) {
 
-void throw_elf_error() {
-	throw std::runtime_error("invalid elf file");
-}
-
-unsigned name_to_region(const std::string &name) {
-	static std::unordered_map<std::string, unsigned> map = {
-		{"registers", REGION_DP},
-		{"tiny", REGION_DP},
-		{"ztiny", REGION_DP},
-		{"stack", REGION_DP},
-
-		{"data", REGION_NEAR},
-		{"cdata", REGION_NEAR},
-		{"zdata", REGION_NEAR},
-
-		{"near", REGION_NEAR},
-		{"cnear", REGION_NEAR},
-		{"znear", REGION_NEAR},
+	// gcc doesn't like std::xdigit w/ std::all_of
 
-		{"far", REGION_FAR},
-		{"cfar", REGION_FAR},
-		{"zfar", REGION_FAR},
+	if (s.length() != 2 && s.length() != 7) return false;
+	if (!std::all_of(s.begin(), s.begin() + 2, isxdigit)) return false;
+	if (s.length() == 7) {
+		if (s[2] != ',' && s[2] != ':') return false;
+		if (!std::all_of(s.begin() + 3, s.end(), isxdigit)) return false;
+	}
 
-		{"huge", REGION_FAR},
-		{"chuge", REGION_FAR},
-		{"zhuge", REGION_FAR},
+	auto lambda = [](int lhs, uint8_t rhs){
+		lhs <<= 4;
+		if (rhs <= '9') return lhs + rhs - '0';
+		return lhs + (rhs | 0x20) - 'a' + 10;
 	};
 
+	options.file_type = std::accumulate(s.begin(), s.begin() + 2, 0, lambda);
+	options.aux_type = 0;
 
-	auto iter = map.find(name);
-	return (iter == map.end()) ? 0 : iter->second; 
+	if (s.length() == 7)
+		options.aux_type = std::accumulate(s.begin() + 3, s.end(), 0, lambda);
+
+	return true;
 }
 
-unsigned type_to_type(unsigned sh_type, unsigned sh_flags) {
-	if (sh_type == SHT_NOBITS) return TYPE_BSS;
+bool parse_stack(const std::string &s, link_options &options) {
+	if (s.empty()) return false;
 
-	if (sh_type == SHT_PROGBITS) {
-		if (sh_flags & SHF_EXECINSTR) return TYPE_CODE;
-		if (sh_flags & SHF_WRITE) return TYPE_DATA;
-		return TYPE_CDATA;
+	int rv = 0;
+	size_t end = 0;
+	try {
+		rv = std::stoi(s, &end, 10);
+	} catch (std::exception &ex) {
+		return false;
 	}
-	// should not happen...
-	return 0;
+	if (rv < 0) return false;
+	rv = (rv + 0xff) & ~0xff;
+	if (rv > 0x8000) return false; // in theory 48k
+	if (end != s.length()) return false;
+	options.stack = rv;
+	return true;
 }
 
-typedef std::unordered_map<std::string, unsigned> symbol_map;
-typedef std::unordered_map<std::string, unsigned> section_map;
-
-/* find or create a symbol */
-symbol &find_symbol(const std::string &name) {
-	auto iter = global_symbol_map.find(name);
-	if (iter == global_symbol_map.end()) {
-		auto &sym = global_symbols.emplace_back();
-		sym.name = name;
-		sym.id = global_symbols.size();
+bool parse_jobs(const std::string &s, link_options &options) {
+	if (s.empty()) return false;
 
-		global_symbol_map.emplace(name, sym.id);
-		return sym;
+	int rv = 0;
+	size_t end = 0;
+	try {
+		rv = std::stoi(s, &end, 10);
+	} catch (std::exception &ex) {
+		return false;
 	}
-	return global_symbols[iter->second - 1];
-}
-
-symbol *maybe_find_symbol(const std::string &name) {
-	auto iter = global_symbol_map.find(name);
-	return (iter == global_symbol_map.end()) ? nullptr : &global_symbols[iter->second - 1];
+	if (rv < 1) return false;
+	if (end != s.length()) return false;
+	options.jobs = rv;
+	return true;
 }
 
+// size[k|m|g][:days]
+bool parse_cache_limit(const std::string &s, link_options &options) {
+	if (s.empty()) return false;
 
-#if 0
-symbol &find_symbol(const std::string &name, bool anonymous) {
-
-	auto iter = global_symbol_map.find(name);
-	if (iter == global_symbol_map.end()) {
-		auto &sym = global_symbols.emplace_back();
-		sym.name = name;
-		sym.id = global_symbols.size();
-
-		if (!anonymous) global_symbol_map.emplace(name, sym.id);
-		return sym;
+	std::string size = s.substr(0, s.find(':'));
+	uint64_t rv = 0;
+	size_t end = 0;
+	try {
+		rv = std::stoull(size, &end, 10);
+	} catch (std::exception &ex) {
+		return false;
 	}
-	return global_symbols[iter->second - 1];
-}
-#endif
-
-// lookup/create a symbol table first in the local table, then in the global table.
-symbol &find_symbol(const std::string &name, std::unordered_map<std::string, int> &local_symbol_map, bool create_locally = false) {
-
-	auto iter = local_symbol_map.find(name);
-	if (iter == local_symbol_map.end()) {
-		if (!create_locally) return find_symbol(name);
-		auto &sym = global_symbols.emplace_back();
-		sym.name = name;
-		sym.id = global_symbols.size();
-		local_symbol_map.emplace(name, sym.id);
-		return sym;
+	if (end < size.length()) {
+		switch (size[end++] | 0x20) {
+			case 'k': rv <<= 10; break;
+			case 'm': rv <<= 20; break;
+			case 'g': rv <<= 30; break;
+			default: return false;
+		}
 	}
-
-	return global_symbols[iter->second - 1];
-}
-
-
-
-/* find or create a section */
-section &find_section(const std::string &name) {
-
-	/* special case for known dp segments! */
-
-	auto iter = global_section_map.find(name);
-	if (iter == global_section_map.end()) {
-		auto &s = global_sections.emplace_back();
-		s.name = name;
-		s.id = global_sections.size();
-
-
-		s.region = name_to_region(name);
-
-		global_section_map.emplace(name, s.id);
-		return s;
+	if (end != size.length()) return false;
+
+	unsigned days = 0;
+	if (size.length() < s.length()) {
+		std::string tmp = s.substr(size.length() + 1);
+		try {
+			days = std::stoul(tmp, &end, 10);
+		} catch (std::exception &ex) {
+			return false;
+		}
+		if (end != tmp.length()) return false;
 	}
-	return global_sections[iter->second - 1];
-}
-
-section *maybe_find_section(const std::string &name) {
-	auto iter = global_section_map.find(name);
-	if (iter == global_section_map.end()) return nullptr;
-	return &global_sections[iter->second - 1];
-}
-
-bool must_swap(const Elf32_Ehdr &header) {
-	if (endian::native == endian::little) return header.e_ident[EI_DATA] == ELFDATA2MSB;
-	if (endian::native == endian::big) return header.e_ident[EI_DATA] == ELFDATA2LSB;
-	return false;
-}
-
-int load_elf_header(int fd, Elf32_Ehdr &header) {
-
-	ssize_t ok = read(fd, &header, sizeof(header));
-	if (ok < 0) throw_errno("read");
-	if (ok != sizeof(header)) throw_elf_error();
-
-	if (memcmp(header.e_ident, ELFMAG, SELFMAG)) throw_elf_error();
 
-	if (must_swap(header)) bswap(header);
-
-	return 0;
+	options.cache_size = rv;
+	options.cache_days = days;
+	return true;
 }
 
-int load_elf_sections(int fd, const Elf32_Ehdr &header, std::vector<Elf32_Shdr> &sections) {
+// split a line into whitespace separated words.  Words may be quoted
+// with ' or " and \ escapes the next character.  With comments, an
+// unquoted # ends the line.
+bool split_words(const std::string &line, std::vector<std::string> &out, bool comments = false) {
 
+	std::string word;
+	bool in_word = false;
+	char quote = 0;
 
-	sections.resize(header.e_shnum);
+	for (size_t i = 0; i < line.length(); ++i) {
+		char c = line[i];
 
-	if (lseek(fd, header.e_shoff, SEEK_SET) < 0) throw_errno("lseek");
-	size_t ok = read(fd, sections.data(), header.e_shnum * sizeof(Elf32_Shdr));
-	if (ok < 0) throw_errno("read");
-	if (ok != header.e_shnum * sizeof(Elf32_Shdr)) throw_elf_error();
-
-	if (must_swap(header)) {
-		for (auto &e : sections) {
-			bswap(e);
+		if (quote) {
+			if (c == quote) quote = 0;
+			else if (c == '\\' && quote == '"' && i + 1 < line.length()) word.push_back(line[++i]);
+			else word.push_back(c);
+			continue;
+		}
+		if (comments && c == '#') break;
+		if (isspace((unsigned char)c)) {
+			if (in_word) out.emplace_back(std::move(word));
+			word.clear();
+			in_word = false;
+			continue;
 		}
+		in_word = true;
+		if (c == '"' || c == '\'') quote = c;
+		else if (c == '\\' && i + 1 < line.length()) word.push_back(line[++i]);
+		else word.push_back(c);
 	}
-
-	return 0;
+	if (quote) return false;
+	if (in_word) out.emplace_back(std::move(word));
+	return true;
 }
 
-int load_elf_data(int fd, const Elf32_Ehdr &header, const Elf32_Shdr& section, std::vector<uint8_t> &rv) {
-
-	if (lseek(fd, section.sh_offset, SEEK_SET) < 0)
-		throw_errno("lseek");
-
-	if (section.sh_size == 0) return 0; // just in case...
+// read a file one line at a time.
+template<class F>
+void read_lines(const std::string &path, F fn) {
 
-	size_t size = rv.size();
-	rv.resize(size + section.sh_size);
-	ssize_t ok = read(fd, rv.data() + size, section.sh_size);
-	if (ok < 0) throw_errno("read");
-	if (ok != section.sh_size) throw_elf_error();
-
-	return 0;
+	FILE *fp = fopen(path.c_str(), "r");
+	if (!fp) err(EX_NOINPUT, "%s", path.c_str());
 
+	char *cp = nullptr;
+	size_t cap = 0;
+	ssize_t len;
+	unsigned line_no = 0;
+	while ((len = getline(&cp, &cap, fp)) >= 0) {
+		std::string line(cp, len);
+		fn(line, ++line_no);
+	}
+	free(cp);
+	fclose(fp);
 }
 
-int load_elf_string_table(int fd, const Elf32_Ehdr &header, const Elf32_Shdr& section, std::vector<uint8_t> &rv) {
+// expand @file arguments.  Response files contain whitespace separated
+// arguments and may refer to other response files.
+void expand_response_file(const std::string &arg, std::vector<std::string> &out, unsigned depth = 0) {
 
-	rv.resize(0);
-	int ok = load_elf_data(fd, header, section, rv);
-	if (ok == 0 && rv.size() && rv.back() != 0) rv.push_back(0);
-	return ok;
+	if (arg.length() < 2 || arg.front() != '@') {
+		out.push_back(arg);
+		return;
+	}
+	if (depth > 16) errx(EX_USAGE, "%s: response files nested too deeply", arg.c_str());
+
+	std::string path = arg.substr(1);
+	read_lines(path, [&](const std::string &line, unsigned line_no){
+		std::vector<std::string> words;
+		if (!split_words(line, words))
+			errx(EX_DATAERR, "%s:%u: unterminated quote", path.c_str(), line_no);
+		for (const auto &w : words)
+			expand_response_file(w, out, depth + 1);
+	});
 }
 
+/*
+ * manifest files.  one directive per line, an unquoted # starts a comment.
+ *
+ * input file [optional]   add an input file (optional: skip it if it doesn't exist)
+ * output file             same as -o
+ * stack size              same as -S
+ * type xx[:xxxx]          same as -t
+ * jobs count              same as -j
+ * cache dir               same as -c
+ * cache-limit size[:days] same as -z
+ * v1                      same as -1
+ * no-express              same as -X
+ * no-super                same as -C
+ */
 
-template<class T>
-int load_elf_type(int fd, const Elf32_Ehdr &header, const Elf32_Shdr& section, std::vector<T> &rv) {
-
-	rv.resize(0);
-	if (section.sh_size == 0) return 0;
-	if (section.sh_entsize != sizeof(T)) throw_elf_error("unexpected entry size");
+// split a manifest line into words; false if it's blank.
+bool manifest_words(const std::string &path, const std::string &line, unsigned line_no, std::vector<std::string> &words) {
+	if (!split_words(line, words, true))
+		errx(EX_DATAERR, "%s:%u: unterminated quote", path.c_str(), line_no);
+	return !words.empty();
+}
 
-	if (lseek(fd, section.sh_offset, SEEK_SET) < 0)
-		throw_errno("lseek");
+// apply one directive to options/inputs.  Returns false if it's unknown.
+bool manifest_directive(const std::string &path, unsigned line_no, const std::vector<std::string> &words,
+	link_options &options, std::vector<input_spec> &inputs) {
 
-	rv.resize(section.sh_size / section.sh_entsize);
+	const std::string &directive = words.front();
 
-	ssize_t ok = read(fd, rv.data(), section.sh_size);
-	if (ok < 0) throw_errno("read");
-	if (ok != section.sh_size) throw_elf_error();
+	auto error = [&](const char *msg){
+		errx(EX_DATAERR, "%s:%u: %s: %s", path.c_str(), line_no, directive.c_str(), msg);
+	};
+	auto expect = [&](size_t count){
+		if (words.size() != count + 1) error("wrong number of arguments");
+	};
 
-	if (must_swap(header)) {
-		for (auto &e : rv) {
-			bswap(e);
+	if (directive == "input") {
+		if (words.size() != 2 && words.size() != 3) error("wrong number of arguments");
+		auto &spec = inputs.emplace_back();
+		spec.filename = words[1];
+		if (words.size() == 3) {
+			if (words[2] != "optional") error("invalid option");
+			spec.optional = true;
 		}
+		return true;
 	}
-	return 0;
-}
-
-
-
-
-
-static unsigned type_to_size[16] = { 0, 1, 2, 3, 4, 8, 0, 0, 1, 2, 2, 1, 2, 3, 2, 2 };
-static unsigned type_to_shift[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 16, 0, 16 };
-
-int abs_reloc(std::vector<uint8_t> &data, uint32_t offset, uint32_t value, unsigned type) {
-
-	if (type > 15) return -1;
-	unsigned size = type_to_size[type];
-	unsigned shift = type_to_shift[type];
-
-	if (offset >= data.size()) return -1;
-	if (offset + size > data.size()) return -1;
-
-	switch (type) {
-	case 0:
-	case 6:
-	case 7:
-		/* unknown type */
-		return -1;
-	case 1: /* dp */
-	case 8:
-		if (value > 0xff) warn(".tiny absolute relocation overflow");
-		break;
-	case 2: /* abs */
-	case 9:
-		if (value > 0xffff) warn(".near absolute relocation overflow");
-		break;
-	case 3: /* long */
-		if (value > 0xffffff) warn(".far absolute relocation overflow");
-		break;
-	case 10: /* .kbank */
-		if (value > 0xffff) warn(".kbank absolute relocation overflow");
-		break;
+	if (directive == "output") {
+		expect(1);
+		options.o = words[1];
+		return true;
 	}
-
-	if (shift) value >>= shift;
-	for (unsigned i = 0; i < size; ++i, ++offset, value >>= 8) {
-		data[offset] = value & 0xff;
+	if (directive == "stack") {
+		expect(1);
+		if (!parse_stack(words[1], options)) error("invalid size");
+		return true;
 	}
-
-	return 0;
-}
-
-/* do an absolute relocation. */
-int abs_reloc(section &section, uint32_t offset, uint32_t value, unsigned type) {
-
-	return abs_reloc(section.data, offset, value, type);
+	if (directive == "type") {
+		expect(1);
+		if (!parse_ft(words[1], options)) error("invalid file type");
+		return true;
+	}
+	if (directive == "jobs") {
+		expect(1);
+		if (!parse_jobs(words[1], options)) error("invalid count");
+		return true;
+	}
+	if (directive == "cache") {
+		expect(1);
+		options.c = words[1];
+		return true;
+	}
+	if (directive == "cache-limit") {
+		expect(1);
+		if (!parse_cache_limit(words[1], options)) error("invalid limit");
+		return true;
+	}
+	if (directive == "v1") {
+		expect(0);
+		options.omf_flags |= OMF_V1;
+		return true;
+	}
+	if (directive == "no-express") {
+		expect(0);
+		options.omf_flags |= OMF_NO_EXPRESS;
+		return true;
+	}
+	if (directive == "no-super") {
+		expect(0);
+		options.omf_flags |= OMF_NO_SUPER;
+		return true;
+	}
+	return false;
 }
 
+void read_manifest(const std::string &path, std::vector<input_spec> &inputs) {
 
+	read_lines(path, [&](const std::string &line, unsigned line_no){
 
-void simplify_relocations() {
-	// 1. reify SHN_ABS
-	// 2. reify dp references, if possible.
-	// n.b. - section #1 is the merged dp/stack section.
-
-	for (auto &s : global_sections) {
-
-		auto it = std::remove_if(s.relocs.begin(), s.relocs.end(), [&](const auto &r){
+		std::vector<std::string> words;
+		if (!manifest_words(path, line, line_no, words)) return;
 
-			const auto &sym = global_symbols[r.symbol - 1];
-			if (sym.section == -1) {
-				// absolute
-				abs_reloc(s, r.offset, sym.offset, r.type);
-				return true;
-			}
-
-#if 0
-			if (sym.section == 1) {
-				if (r.type == 1 || r.type == 8 || r.type == 11) {
-					abs_reloc(s, r.offset, r.value + sym.offset, r.type);
-					return true;
-				}
-			}
-#endif
-			return false;
-		});
-		s.relocs.erase(it, s.relocs.end());
-	}
+		if (!manifest_directive(path, line_no, words, flags, inputs))
+			errx(EX_DATAERR, "%s:%u: %s: unknown directive", path.c_str(), line_no, words.front().c_str());
+	});
 }
 
-// .section attributes:
-// rodata -> SHT_PROGBITS, SHF_ALLOC
-// text   -> SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR
-// data   -> SHT_PROGBITS, SHF_ALLOC | SHF_WRITE
-// bss    -> SHT_NOBITS,   SHF_ALLOC | SHF_WRITE
-
-
-// linker generated symbols:
-// _O\x03.sectionStart_[name]
-// _O\x03.sectionEnd_[name]
-// _O\x03.sectionSize_[name] (32-bit absolute)
-// _DirectPageStart
- 
 /*
- * standard segments
- * dp:
- *   registers, tiny, ztiny
- * code:
- *   code, compactcode,farcode,
- * data:
- *   data, cdata (ro) zdata (bss)
- *   near, cnear (ro), znear (bss)
- *   far , cfar (ro), zfar (bss)
- *   huge, chuge, (ro) zhuge (bss)
+ * batch files (-B).  Manifest syntax, where
  *
- * calypsi linker-generated:
- *   itiny, idata, inear, ifar, ihuge, data_init_table
- * other:
- *   reset, stack, heap
+ * target file             starts a new output file
  *
+ * and the directives which follow (up to the next target) apply to it.
+ * Each target starts with the command line's options.
  */
+struct batch_target {
+	link_options options;
+	std::vector<input_spec> inputs;
+};
 
+void read_batch(const std::string &path, std::vector<batch_target> &targets) {
 
+	read_lines(path, [&](const std::string &line, unsigned line_no){
 
-// if there is a stack segment, it will be adjusted later
-void generate_linker_symbols(void) {
-	// .sectionStart, .sectionEnd, .sectionSize.
-	for (auto &s : global_sections) {
-
-		std::string name;
-		symbol *sym;
+		std::vector<std::string> words;
+		if (!manifest_words(path, line, line_no, words)) return;
 
-		name = "_O\x03.sectionStart_" + s.name;
-		if ((sym = maybe_find_symbol(name))) {
-			sym->section = s.id;
-			sym->offset = 0;
-		}
+		const std::string &directive = words.front();
 
-		name = "_O\x03.sectionEnd_" + s.name;
-		if ((sym = maybe_find_symbol(name))) {
-			sym->section = s.id;
-			sym->offset = s.data.size() - 1;
+		if (directive == "target") {
+			if (words.size() != 2)
+				errx(EX_DATAERR, "%s:%u: %s: wrong number of arguments", path.c_str(), line_no, directive.c_str());
+			auto &t = targets.emplace_back();
+			t.options = flags;
+			t.options.o = words[1];
+			return;
 		}
+		if (targets.empty())
+			errx(EX_DATAERR, "%s:%u: %s: no target", path.c_str(), line_no, directive.c_str());
 
-		name = "_O\x03.sectionSize_" + s.name;
-		if ((sym = maybe_find_symbol(name))) {
-			sym->section = -1;
-			sym->offset = s.data.size();
-			sym->absolute = true;
-		}
-	}
+		auto &t = targets.back();
+		if (!manifest_directive(path, line_no, words, t.options, t.inputs))
+			errx(EX_DATAERR, "%s:%u: %s: unknown directive", path.c_str(), line_no, directive.c_str());
+	});
 }
 
+bool index_directory(const std::string &dir) {
 
-bool check_for_missing_symbols(bool pass1 = true) {
-
-	// linker-generated symbols.
-	static std::unordered_set<std::string> skippable = {
-		"_DirectPageStart", "_NearBaseAddress",
-		"_O\x03.sectionStart_stack",
-		"_O\x03.sectionEnd_stack",
-		"_O\x03.sectionSize_stack",
-	};
-
-	bool ok = true;
-	for (auto &sym : global_symbols) {
-
-		if (!sym.count) continue;
-		if (sym.absolute) continue;
-		if (sym.section == 0) {
-			if (pass1 && skippable.count(sym.name)) continue;
-			warnx("undefined symbol: %s", sym.name.c_str());
-			ok = false;
-		}
+	DIR *dp = opendir(dir.c_str());
+	if (!dp) {
+		warn("opendir %s", dir.c_str());
+		return false;
 	}
-	return ok;
-}
-
 
-template<class T>
-void move_or_append(std::vector<T> &out, std::vector<T> &in) {
-
-	if (out.empty()) {
-		out = std::move(in);
-	} else {
-		out.insert(out.end(), in.begin(), in.end());
+	std::vector<symbol_index::file> files;
+	while (struct dirent *d = readdir(dp)) {
+		std::string name = d->d_name;
+		if (name.size() < 3 || name.compare(name.size() - 2, 2, ".o")) continue;
+		files.emplace_back().name = std::move(name);
 	}
-}
+	closedir(dp);
 
+	// readdir order is arbitrary; the first definition of a symbol wins.
+	std::sort(files.begin(), files.end(), [](const auto &a, const auto &b){
+		return a.name < b.name;
+	});
 
-template<class T>
-void append(std::vector<T> &out, const std::vector<T> &in) {
-
-	out.insert(out.end(), in.begin(), in.end());
-}
-
-typedef std::vector<std::reference_wrapper<section>> section_ref_vector ;
-
-// counts up region sizes.
-unsigned analyze(const section_ref_vector &sections, unsigned data[5][7]) {
-
-	unsigned total = 0;
-	for (const section &s : sections) {
+	std::string prefix = dir;
+	if (prefix.back() != '/') prefix.push_back('/');
 
-		unsigned sz = data[s.region][s.type];
-		unsigned x = s.size();
+	std::vector<std::string> errors(files.size());
+	parallel_for(flags.jobs, files.size(), [&](size_t i){
+		auto &f = files[i];
+		std::string path = prefix + f.name;
 
-		unsigned mask = 0;
-		if (s.align > 1) {
-			mask = s.align - 1;
-			sz = (sz + mask) & ~mask;
-			total = (total + mask) & ~mask;
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			errors[i] = strerror(errno);
+			return;
 		}
 
-		data[s.region][s.type] = sz + x;
-		total += x;
-
-		// total this region excl code [?]
-		if (s.type != TYPE_CODE) {
-			sz = data[s.region][5];
-			if (mask) sz = (sz + mask) & ~mask;
-			data[s.region][5] = sz + x;
+		try {
+			struct stat st;
+			if (fstat(fd, &st) < 0) throw_errno("fstat");
+			if (!S_ISREG(st.st_mode)) throw_elf_error("not a regular file");
+			f.st = symbol_index::make_stamp(st);
+
+			elf_file file(fd);
+			const auto &header = file.header();
+			if (header.e_type != ET_REL || header.e_machine != EM_65816)
+				throw_elf_error("Not a 65816 elf file");
+
+			auto sections = file.sections();
+			for (const auto &s : sections) {
+				if (s.sh_type != SHT_SYMTAB) continue;
+				if (s.sh_link >= sections.size()) throw_elf_error();
+				auto strings = file.strings(sections[s.sh_link]);
+				for (const auto &sym : file.table<Elf32_Sym>(s)) {
+					if (ELF32_ST_BIND(sym.st_info) == STB_LOCAL) continue;
+					if (sym.st_shndx == SHN_UNDEF) continue;
+					if (!strings.valid(sym.st_name)) continue;
+					f.symbols.emplace_back(strings[sym.st_name]);
+				}
+			}
+		} catch (std::exception &ex) {
+			errors[i] = ex.what();
 		}
+		close(fd);
+	});
 
-		// total this region
-		sz = data[s.region][6];
-		if (mask) sz = (sz + mask) & ~mask;
-		data[s.region][6] = sz + x;
+	bool ok = true;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (errors[i].empty()) continue;
+		warnx("%s%s: %s", prefix.c_str(), files[i].name.c_str(), errors[i].c_str());
+		ok = false;
 	}
-	return total;
-}
-
+	if (!ok) return false;
 
-void to_omf(void) {
-
-
-	section *stack = nullptr;
-	// make sure there's a stack segment if needed.
-	{
-		auto s = maybe_find_section("stack");
-		if (s) {
-			stack = s;
-			if (s->type != TYPE_BSS) errx(1, "stack section not bss");
-			s->bss_size = (s->bss_size + 0xff) & ~0xff;
-			s->align = 0;
-			if (flags.stack && flags.stack != s->size()) {
-				warnx("-S ignored");
-			}
-		} else if (flags.stack) {
-			auto &s = find_section("stack");
-			s.type = TYPE_BSS;
-			s.bss_size = flags.stack;
-			stack = &s;
-		}
+	std::string path = symbol_index::index_path(dir);
+	try {
+		size_t count = symbol_index::write(path, files);
+		if (flags.v) printf("%s: %zu files, %zu symbols\n", path.c_str(), files.size(), count);
+	} catch (std::exception &ex) {
+		warnx("%s", ex.what());
+		return false;
 	}
+	return true;
+}
 
 
-	section_ref_vector sections;
-	section_ref_vector dp_sections;
+// parse the objects a link child reported, for the next link.
+void resident_refresh(std::vector<std::string> &paths) {
 
-	sections.reserve(global_sections.size());
-	dp_sections.reserve(4);
+	std::sort(paths.begin(), paths.end());
+	paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
 
-	for (auto &s : global_sections) {
-		if (s.type == TYPE_BSS) continue;
+	link_context::parse_resident(paths, resident.objects, flags.jobs);
+	if (flags.v) printf("Resident objects: %zu parsed, %zu total\n", paths.size(), resident.objects.size());
+}
 
-		if (s.region == REGION_DP) {
-			dp_sections.push_back(std::ref(s));
-		} else {
-			sections.push_back(std::ref(s));
-		}
+// report the objects this link child parsed itself.
+void resident_report(void) {
+	std::string buffer;
+	for (const auto &path : resident.misses) {
+		buffer.append(path);
+		buffer.push_back(0);
 	}
-	// bss last
-	for (auto &s : global_sections) {
-		if (s.type != TYPE_BSS) continue;
-
-		if (s.region == REGION_DP) {
-			if (&s == stack) continue; // special handling... 
-			dp_sections.push_back(std::ref(s));
-		} else {
-			sections.push_back(std::ref(s));
-		}
+	const char *p = buffer.data();
+	size_t size = buffer.size();
+	while (size) {
+		ssize_t n = write(resident.report_fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		p += n;
+		size -= n;
 	}
+	close(resident.report_fd);
+}
 
-	// sort the dp sections - registers, tiny, ztiny, stack
-	// n.b. - aside from stack, these are alphabetical. so just compare the first letter.
-	std::sort(dp_sections.begin(), dp_sections.end(), [](const section &a, const section &b){
-		unsigned ca = a.name.front();
-		unsigned cb = b.name.front();
-		if (ca == 's') ca = 'z'+1;
-		if (cb == 's') cb = 'z'+1;
-		return ca < cb;
-	});
-
-
-	unsigned sizes[5][7] = {};
-
-	unsigned total = analyze(sections, sizes);
-	analyze(dp_sections, sizes);
-	// best case -- 1 segment!
-
-	// link types
-	// 1. everything goes in 1 segment
-	// 2. all near segments merged
-	// 3. all near data merged, separate near code
-	// 4. 
-
-
-	std::vector<omf::segment> segments;
-	unsigned segnum = 1;
-	if (total < 0x010000) {
-		auto &seg = segments.emplace_back();
-		seg.segnum = segnum++;
-
-
-		unsigned offset = 0;
-		bool need_align = false;
-		for (section &s : sections) {
-
-			unsigned mask = 0;
-			unsigned sz = s.size();
-			if (s.align > 1) {
-				need_align = true;
-				mask = s.align - 1;
-			}
-
-
-
-			if (s.type == TYPE_BSS) {
-
-				if (mask) {
-					unsigned orig = offset;
-					offset = (offset + mask) & ~mask;
-					seg.reserved_space += (offset - orig);
-				}
-				seg.reserved_space += sz;
-			} else {
-
-				if (mask) {
-					offset = (offset + mask) & ~mask;
-					seg.data.resize(offset);
-				}
-
-				append(seg.data, s.data);
-			}
-
-			s.omf_segment = seg.segnum;
-			s.omf_offset = offset;
-			offset += sz;
-		}
-		// omf only has page or bank alignment.
-		if (need_align) seg.alignment = 0x0100;
+// fork a link child which reuses the resident objects.  Returns 0 in the
+// child; in the parent, the child's pid (or -1) and the read end of the
+// pipe it reports on.
+pid_t resident_fork(int &fd) {
 
+	int report[2];
+	if (pipe(report) < 0) {
+		warn("pipe");
+		return -1;
+	}
 
-		//
-		symbol *sym;
-		if ((sym = maybe_find_symbol("_NearBaseAddress"))) {
-			const section &s = sections.front(); 
-			sym->section = s.id;
-			sym->offset = 0;
-		}
+	fflush(stdout);
+	fflush(stderr);
 
-	} else {
-		errx(1, "not yet...");
+	pid_t pid = fork();
+	if (pid < 0) {
+		warn("fork");
+		close(report[0]);
+		close(report[1]);
+		return -1;
 	}
 
-	// now handle the dp segment.
-	unsigned dp_size = analyze(dp_sections, sizes);
+	if (pid == 0) {
+		close(report[0]);
+		resident.child = true;
+		resident.report_fd = report[1];
+		atexit(resident_report);
+		return 0;
+	}
 
-	// could also check if we need an explicit direct page --
-	// via symbols (.sectionStart stack, _DirectPageStart)
+	close(report[1]);
+	fd = report[0];
+	return pid;
+}
 
-	if (dp_size > 0 || stack) {
+// wait for a link child.  Returns its exit status and adds the objects it
+// parsed to paths.
+int resident_wait(pid_t pid, int fd, std::vector<std::string> &paths) {
+
+	std::string buffer;
+	char tmp[4096];
+	for(;;) {
+		ssize_t n = read(fd, tmp, sizeof(tmp));
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		buffer.append(tmp, n);
+	}
+	close(fd);
 
-		if (dp_size > 0xff) {
-			errx(1, "dp exceeds 1 page ($%04x)", dp_size);
-		}
+	int status = 0;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR) ;
 
-		if (dp_size > 0 && !stack) {
-			errx(1, "stack section missing.  Use -S size or create a bss stack section.");
-		}
+	for (size_t pos = 0; pos < buffer.size(); ) {
+		size_t end = buffer.find('\0', pos);
+		if (end == buffer.npos) break;
+		paths.emplace_back(buffer.substr(pos, end - pos));
+		pos = end + 1;
+	}
 
-		if (stack && stack->size() > 0x8000) {
-			errx(1, "stack too big ($%04x)", stack->size());
-		}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
 
-		int stack_size = stack ? stack->size() - dp_size : 0;
-		if (stack && stack_size <= 0)
-			errx(1, "stack too small ($%04x)", stack_size);
+[[noreturn]] void link_main(int argc, char **argv);
 
-		auto &seg = segments.emplace_back();
-		seg.segnum = segnum++;
-		seg.kind = 0x12; // dp/stack
-		seg.segname = "dp/stack";
+// link server (-s).  Links run one at a time, each in a child process with
+// a fresh copy of the global state (and the server's parsed objects).
+[[noreturn]] void run_server(void) {
 
-		if (stack) {
-			stack->align = 0; // no alignment
-			stack->bss_size = stack_size;
-			dp_sections.emplace_back(std::ref(*stack));
+	std::unique_ptr<link_server> server;
+	try {
+		server.reset(new link_server(flags.s));
+	} catch (std::exception &ex) {
+		errx(1, "%s", ex.what());
+	}
 
-			symbol *sym;
-			// update symbols (only size and end shoud be changing)
+	signal(SIGPIPE, SIG_IGN);
+	bool verbose = flags.v;
 
-			if ((sym = maybe_find_symbol("_O\x03.sectionStart_stack"))) {
-				sym->section = stack->id;
-				sym->offset = 0;
-			}
-			if ((sym = maybe_find_symbol("_O\x03.sectionEnd_stack"))) {
-				sym->section = stack->id;
-				sym->offset = stack_size - 1;
-			}
-			if ((sym = maybe_find_symbol("_O\x03.sectionSize_stack"))) {
-				sym->section = -1;
-				sym->offset = stack_size;
-				sym->absolute = true;
-			}
+	for(;;) {
+		link_request request;
+		try {
+			if (!server->accept(request)) continue;
+		} catch (std::exception &ex) {
+			errx(1, "%s", ex.what());
 		}
 
-		if (!dp_sections.empty()) {
-			symbol *sym;
-			section &s = dp_sections.front();
-			if ((sym = maybe_find_symbol("_DirectPageStart"))) {
-				sym->section = s.id;
-				sym->offset = 0;
-			}
+		int fd = -1;
+		pid_t pid = resident_fork(fd);
+		if (pid < 0) {
+			link_server::reply(request, 1);
+			continue;
 		}
 
-
-		unsigned offset = 0;
-		for (section &s : dp_sections) {
-
-			unsigned mask = 0;
-			unsigned sz = s.size();
-			if (s.align > 1) {
-				mask = s.align - 1;
+		if (pid == 0) {
+			// the client's stdio becomes ours.  The originals are closed so
+			// a cache update child doesn't hold the client's pipes open.
+			for (int i = 0; i < 3; ++i) {
+				dup2(request.stdio[i], i);
+				close(request.stdio[i]);
+				request.stdio[i] = -1;
 			}
+			close(request.fd);
+			request.fd = -1;
 
-			if (s.type == TYPE_BSS) {
+			if (chdir(request.cwd.c_str()) < 0) err(1, "%s", request.cwd.c_str());
+			signal(SIGPIPE, SIG_DFL);
 
-				if (mask) {
-					unsigned orig = offset;
-					offset = (offset + mask) & ~mask;
-					seg.reserved_space += (offset - orig);
-				}
-				seg.reserved_space += sz;
-			} else {
+			std::vector<char *> av;
+			for (auto &a : request.args) av.push_back(&a[0]);
+			av.push_back(nullptr);
 
-				if (mask) {
-					offset = (offset + mask) & ~mask;
-					seg.data.resize(offset);
-				}
-				append(seg.data, s.data);
-			}
-
-			s.omf_segment = seg.segnum;
-			s.omf_offset = offset;
-			offset += sz;
+			flags = decltype(flags)();
+			optind = 1;
+			link_main(av.size() - 1, av.data());
 		}
 
-	}
-
-	// ok, now we can convert dp relocations into absolute values.
-	// ... and convert relocations to omf relocations.
-
-
-	append(sections, dp_sections);
-
-	for (const section &s : sections) {
-
-		auto &seg = segments[s.omf_segment - 1];
-
-		for (const auto &r : s.relocs) {
-
-			const auto &sym = global_symbols[r.symbol - 1];
-
-			unsigned offset = r.offset + s.omf_offset;
-			unsigned value = r.value + sym.offset;
-
-			if (sym.absolute) {
-				abs_reloc(seg.data, offset, value, r.type);
-				continue;
-			}
-
-			if (!r.symbol) errx(1, "relocation missing symbol");
-
-			const auto &src = global_sections[sym.section - 1];
-
-			value += src.omf_offset;
-
-			// convert dp reference to a constant.
-			if (r.type == 1 || r.type == 8 || r.type == 11) {
-				abs_reloc(seg.data, offset, value, r.type);
-				continue;
-			}
-
-			unsigned size = type_to_size[r.type];
-			unsigned shift = -type_to_shift[r.type];
-
-			if (src.omf_segment == s.omf_segment) {
-				omf::reloc rr;
-				rr.size = size;
-				rr.shift = shift;
-				rr.offset = offset;
-				rr.value = value;
-				seg.relocs.push_back(rr);
-			} else {
-				omf::interseg is;
-				is.size = size;
-				is.shift = shift;
-				is.offset = offset;
-				is.segment = src.omf_segment;
-				is.segment_offset = value;
-				seg.intersegs.push_back(is);
-			}
-
-		}
+		std::vector<std::string> paths;
+		int rv = resident_wait(pid, fd, paths);
+		link_server::reply(request, rv);
 
+		if (verbose) printf("%s: exit %d\n", request.cwd.c_str(), rv);
+		if (!paths.empty()) resident_refresh(paths);
 	}
-
-
-	save_omf(flags.o, segments, flags.omf_flags);
 }
 
-
-int one_file(const std::string &filename) {
-	// process one elf file.
-
-	// 1. open, verify it's a 65816 elf file
-	// 2. merge sections
-	// 3. update symbols
-	// 4. process relocation records that refer to a private symbol????
-	// 5. add relocation records ()
-
-	// map local elf section to global section
-	struct section_map {
-		int section = 0;
-		int offset = 0;
-	};
-
-	int fd;
-	Elf32_Ehdr header;
-	std::vector<Elf32_Shdr> sections;
-
-
-	std::vector<section_map> local_section_map;
-
-	if (flags.v) printf("%s...\n", filename.c_str());
-	fd = open(filename.c_str(), O_RDONLY);
-	if (fd < 0) {
-		warn("open %s", filename.c_str());
-		return -1;
+#ifdef __linux__
+// watch mode (-w).  Link, then relink whenever an input is rewritten.  The
+// links run in child processes, like the server's, so only the changed
+// inputs are parsed.  Returns in each link child.
+void watch_inputs(const std::vector<input_spec> &inputs) {
+
+	// how long the inputs must be quiet before relinking.
+	const int debounce_ms = 50;
+
+	int ifd = inotify_init1(IN_CLOEXEC);
+	if (ifd < 0) err(1, "inotify_init1");
+
+	// assemblers often write a temporary file and rename it, so watch the
+	// directories rather than the files.
+	std::unordered_set<std::string> watched;
+	std::unordered_map<int, std::string> directories;
+	for (const auto &spec : inputs) {
+		if (spec.filename == "-") errx(EX_USAGE, "-w can't be used with stdin");
+		std::string path = absolute_path(spec.filename);
+		size_t slash = path.rfind('/');
+
+		char buffer[PATH_MAX];
+		std::string dir = slash ? path.substr(0, slash) : "/";
+		if (!realpath(dir.c_str(), buffer)) err(1, "%s", dir.c_str());
+		dir = buffer;
+
+		int wd = inotify_add_watch(ifd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+		if (wd < 0) err(1, "%s", dir.c_str());
+
+		if (dir == "/") dir.clear();
+		directories[wd] = dir;
+		watched.insert(dir + path.substr(slash));
 	}
 
-	try {
-		load_elf_header(fd, header);
-
-		// verify elf file info
-		bool ok = true;
-		if (header.e_ident[EI_CLASS] != ELFCLASS32) ok = false;
-		if (header.e_ident[EI_VERSION] != EV_CURRENT) ok = false;
-		if (header.e_type != ET_REL) ok = false;
-		if (header.e_machine != EM_65816) ok = false;
-		if (header.e_version != EV_CURRENT) ok = false;
-		if (header.e_shentsize != sizeof(Elf32_Shdr)) ok = false;
-		if (header.e_shnum == 0) ok = false;
-
-		if (!ok) {
-			throw_elf_error("Not a 65816 elf file");
-		}
-
-
-		load_elf_sections(fd, header, sections);
-
-		std::vector<uint8_t> string_table;
-		load_elf_string_table(fd, header, sections[header.e_shstrndx], string_table);
-
-
-		local_section_map.resize(header.e_shnum + 1);
-
-		// pass 1 - process SHT_PROGBITS and SHT_NOBITS
-		// also load the symbol table.
-		// i suppose there could be > 1 symbol table but only one supported for now.
-		int current_st = -1;
-		std::vector<Elf32_Sym> st;
-
-		int sh_num = -1;
-		for (const auto &s : sections) {
-
-			++sh_num;
-			if (s.sh_type == SHT_SYMTAB) {
-				if (current_st != -1) throw_elf_error("multiple symbol tables");
-				current_st = sh_num;
-				load_elf_type<Elf32_Sym>(fd, header, s, st);
-				continue;
-			}
-
-			std::string name;
-			if (s.sh_name && s.sh_name < string_table.size())
-				name = (char *)string_table.data() + s.sh_name;
-
-
-			if (s.sh_type == SHT_NOBITS) {
-
-
-				section &gs = find_section(name);
-				if (gs.type == 0) gs.type = TYPE_BSS;
-
-
-				if (gs.type != TYPE_BSS)
-					errx(1, "%s: %s - section type mismatch", filename.c_str(), name.c_str());
-
-
-				gs.align = std::max(gs.align, s.sh_addralign);
-				if (gs.align > 1) {
-					unsigned mask = gs.align - 1;
-					gs.bss_size = (gs.bss_size + mask) & ~mask;
-				}				
-
-				local_section_map[sh_num].section = gs.id;
-				local_section_map[sh_num].offset = gs.bss_size;
-
-				gs.bss_size += s.sh_size;
-				continue;
-			}
-
-			if (s.sh_type == SHT_PROGBITS) {
-
-				section &gs = find_section(name);
-				unsigned t = type_to_type(s.sh_type, s.sh_flags);
-				if (gs.type == 0) {
-					gs.type = t;
-				}
-				if (gs.type != t) {
-					errx(1, "%s:%s - section type mismatch", filename.c_str(), name.c_str());
-				}
-
-				auto &data = gs.data;
-				gs.align = std::max(gs.align, s.sh_addralign);
+	std::unordered_set<std::string> changed;
+	alignas(inotify_event) char buffer[16384];
 
-				if (gs.align > 1) {
-					unsigned mask = (gs.align - 1);
-					if (data.size() & mask)
-						data.resize((data.size() + mask) & ~mask);
-				}
-
-				local_section_map[sh_num].section = gs.id;
-				local_section_map[sh_num].offset = data.size();
+	for (unsigned pass = 0; ; ++pass) {
 
-				load_elf_data(fd, header, s, data);
-			}
+		auto start = std::chrono::steady_clock::now();
 
+		int fd = -1;
+		pid_t pid = resident_fork(fd);
+		if (pid == 0) {
+			close(ifd);
+			return;
 		}
 
-
-
-		// pass 1.5 -- load the symbol tables.
-		// local symbols go into the global symbol table but not the global symbol table map.
-		std::unordered_map<std::string, int> local_symbol_map;
-
-		std::vector<int> symbol_to_symbol;
-		symbol_to_symbol.reserve(st.size());
-
-
-		for (const auto &x : st) {
-
-			// copy global/weak symbols to the global symbol table
-			// skip local symbols.
-			unsigned bind = ELF32_ST_BIND(x.st_info);
-			unsigned type = ELF32_ST_BIND(x.st_info);
-
-
-			if (x.st_name == 0 || x.st_name >= string_table.size()) {
-				symbol_to_symbol.push_back(0);
-				continue;
-			}
-			std::string name = (char *)string_table.data() + x.st_name;
-
-
-			// todo -- the .calypsi_info section can make some undefined references
-			// a .require-ment. (also noreorder, others?)
-
-
-			symbol &sym = find_symbol(name, local_symbol_map, bind == STB_LOCAL);
-
-			symbol_to_symbol.push_back(sym.id);
-
-			bool required = false; // todo....
-			if (required) sym.count++;
-
-			if (x.st_shndx == 0) continue;
-
-#if 0
-			if (x.st_shndx != SHN_UNDEF && x.st_shndx != SHN_ABS) {
-				auto &s = global_sections[local_sections [x.st_shndx] - 1];
-				s.symbols.push_back(sym.id);
-			}
-#endif
-
-			if (sym.section == 0) {
-				// new symbol!  let's define it
-				// todo -- SHN_COMMON?
-
-				if (bind == STB_LOCAL) sym.local = true;
-
-				if (x.st_shndx == SHN_COMMON) {
-					errx(1, "SHN_COMMON not yet supported.");
-				}
-				if (x.st_shndx == SHN_ABS) {
-					sym.absolute = true;
-					sym.offset = x.st_value;
-					sym.section = -1;
-				} else {
-					// SHN_UNDEF handled above.
-					sym.section = local_section_map[x.st_shndx].section;
-					sym.offset = x.st_value + local_section_map[x.st_shndx].offset;
-				}
-
-			 } else {
-
-				if (bind == STB_LOCAL) {
-					warnx("%s: duplicate symbol (%s)", filename.c_str(), name.c_str());
-					continue;
-				}
-
-			 	// known symbol.  weak is ok, otherwise, warn.
-				if (bind == STB_GLOBAL) {
-					// allow duplicate absolute symbols?
-					warnx("%s: duplicate symbol (%s)", filename.c_str(), name.c_str());
-					continue;
-				}
+		std::vector<std::string> paths;
+		int rv = pid < 0 ? 1 : resident_wait(pid, fd, paths);
+
+		std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+		if (pass) printf("%zu changed, ", changed.size());
+		printf("%s in %.1f ms%s\n", pass ? "relinked" : "linked", ms.count(),
+			rv ? " (failed)" : "");
+		fflush(stdout);
+
+		if (!paths.empty()) resident_refresh(paths);
+
+		// wait for a change, then for things to settle down.
+		changed.clear();
+		int timeout = -1;
+		for(;;) {
+			pollfd pfd = { ifd, POLLIN, 0 };
+			int n = poll(&pfd, 1, timeout);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) err(1, "poll");
+			if (n == 0) break;
+
+			ssize_t size = read(ifd, buffer, sizeof(buffer));
+			if (size < 0 && errno == EINTR) continue;
+			if (size < 0) err(1, "inotify");
+
+			for (char *p = buffer; p < buffer + size; ) {
+				const auto *ev = (const inotify_event *)p;
+				p += sizeof(inotify_event) + ev->len;
+
+				auto iter = directories.find(ev->wd);
+				if (iter == directories.end() || !ev->len) continue;
+				std::string path = iter->second + "/" + ev->name;
+				if (watched.count(path)) changed.insert(path);
 			}
+			if (!changed.empty()) timeout = debounce_ms;
 		}
+	}
+}
+#endif
 
-		// build map of elf symbol table entries to global_symbol entries?
-
-
-		// pass 2 - process relocation records.
-
-
-		sh_num = -1;
-
-		// pass 2 - process the relocation records.
-		for (const auto &s : sections) {
-			++sh_num;
-			if (s.sh_type != SHT_REL && s.sh_type != SHT_RELA) continue;
-
-
-			// sh_link is the associated symbol table.
-			// sh_info is the associated data section 
-
-			if (current_st != s.sh_link) {
-				throw_elf_error("bad symbol table reference");
-			}
-
-			unsigned section_offset = local_section_map[s.sh_info].offset;
-			unsigned section_id = local_section_map[s.sh_info].section;
-
-			section &gs = global_sections[section_id - 1];
-
-			std::vector<Elf32_Rela> rels;
-
-			if (s.sh_type == SHT_REL) {
-				std::vector<Elf32_Rel> tmp;
-				load_elf_type<Elf32_Rel>(fd, header, s, tmp);
-				std::transform(tmp.begin(), tmp.end(), std::back_inserter(rels), [](const Elf32_Rel &r){
-					Elf32_Rela rr = { r.r_offset, r.r_info, 0 };
-					return rr;
-				});
-			} else {
-				load_elf_type<Elf32_Rela>(fd, header, s, rels);
-			}
-
-			for (const auto &r : rels) {
-				int rsym = ELF32_R_SYM(r.r_info);
-				int rtype = ELF32_R_TYPE(r.r_info);
-
-				if (rsym > symbol_to_symbol.size() || !symbol_to_symbol[rsym]) {
-					warnx("%s: bad relocation", filename.c_str());
-					continue;
-				}
-
-
-				// const auto &sym = st[rsym];
-
-				// unsigned bind = ELF32_ST_BIND(sym.st_info);
-				// unsigned type = ELF32_R_TYPE(sym.st_info);
-
-				auto &sym = global_symbols[symbol_to_symbol[rsym] - 1];
-				sym.count++;
-
-				reloc rr;
+// archives and OMF libraries among the inputs are recognised by their
+// contents, not their names, and are searched after all the objects are
+// loaded, regardless of their position.
+void add_inputs(link_context &context, const std::vector<input_spec> &inputs) {
+
+	for (const auto &spec : inputs)
+		context.add_file(spec.filename, spec.optional);
+	for (const auto &name : flags.l)
+		context.add_library(find_library(name));
+	for (const auto &dir : flags.d)
+		context.add_directory(dir);
+}
 
-				rr.offset = section_offset + r.r_offset;
+// batch mode (-B): each distinct object is parsed once, up front, and the
+// decoded (read-only) objects are shared by all the targets, which are
+// then linked in parallel, one per thread.
+[[noreturn]] void batch_link(std::vector<batch_target> &targets) {
 
-				rr.type = rtype;
-				rr.value = r.r_addend;
-				rr.symbol = sym.id;
-				gs.relocs.push_back(rr);
-			}
+	auto start = std::chrono::steady_clock::now();
 
+	std::vector<std::string> paths;
+	for (const auto &t : targets) {
+		for (const auto &spec : t.inputs) {
+			const auto &name = spec.filename;
+			if (name == "-") continue;
+			paths.push_back(absolute_path(name));
 		}
-	} catch(std::exception &ex) {
-		close(fd);
-		warnx("%s: %s", filename.c_str(), ex.what());
-		return -1;
 	}
+	std::sort(paths.begin(), paths.end());
+	paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
 
-	close(fd);
-	return 0;
-}
+	// optional inputs which don't exist are simply left out of objects.
+	resident_map objects;
+	link_context::parse_resident(paths, objects, flags.jobs);
 
-void init(void) {
+	// -v output isn't grouped by target, so link them one at a time.
+	unsigned jobs = flags.v ? 1 : std::min<size_t>(flags.jobs, targets.size());
 
-// idea... create empty placeholder register, tiny, ztiny, stack segments
-// so they're in the order I want them?
+	std::vector<std::unique_ptr<link_context>> contexts(targets.size());
+	std::vector<char> ok(targets.size());
 
-#if 0
-	// create dp/stack segment for 
-	// this does not go in the name map.
-	{
-		auto &s = global_sections.emplace_back();
-		s.name = "dp/stack";
-		s.id = 1;
-	}
+	for (size_t i = 0; i < targets.size(); ++i) {
+		auto &t = targets[i];
+		if (jobs > 1) t.options.jobs = 1;
+		if (!t.options.jobs) t.options.jobs = flags.jobs;
 
-	{
-		auto &sym = find_symbol("_DirectPageStart");
-		sym.section = 1;
+		auto &context = contexts[i];
+		context.reset(new link_context(t.options));
+		context->use_resident(&objects);
+		add_inputs(*context, t.inputs);
 	}
-	// todo -- "_NearBaseAddress" --> near data bank. 
-#endif
-}
-
-bool parse_ft(const std::string &s) {
 
-	// gcc doesn't like std::xdigit w/ std::all_of
+	parallel_for(jobs, targets.size(), [&](size_t i){
+		ok[i] = contexts[i]->link();
+	});
 
-	if (s.length() != 2 && s.length() != 7) return false;
-	if (!std::all_of(s.begin(), s.begin() + 2, isxdigit)) return false;
-	if (s.length() == 7) {
-		if (s[2] != ',' && s[2] != ':') return false;
-		if (!std::all_of(s.begin() + 3, s.end(), isxdigit)) return false;
+	unsigned failed = 0;
+	for (size_t i = 0; i < targets.size(); ++i) {
+		for (const auto &d : contexts[i]->diagnostics())
+			warnx("%s", d.message.c_str());
+		if (ok[i]) contexts[i]->update_cache(true);
+		else ++failed;
 	}
 
-	auto lambda = [](int lhs, uint8_t rhs){
-		lhs <<= 4;
-		if (rhs <= '9') return lhs + rhs - '0';
-		return lhs + (rhs | 0x20) - 'a' + 10;
-	};
-
-	flags.file_type = std::accumulate(s.begin(), s.begin() + 2, 0, lambda);
-	flags.aux_type = 0;
-
-	if (s.length() == 7)
-		flags.aux_type = std::accumulate(s.begin() + 3, s.end(), 0, lambda);
-
-	return true;
-}
-
-bool parse_stack(const std::string &s) {
-	if (s.empty()) return false;
-
-	int rv = 0;
-	size_t end = 0;
-	try {
-		rv = std::stoi(s, &end, 10);
-	} catch (std::exception &ex) {
-		return false;
+	if (flags.v) {
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		printf("Batch: %zu targets (%u failed), %zu objects, %lld ms\n",
+			targets.size(), failed, objects.size(), (long long)ms);
 	}
-	if (rv < 0) return false;
-	rv = (rv + 0xff) & ~0xff;
-	if (rv > 0x8000) return false; // in theory 48k
-	if (end != s.length()) return false;
-	flags.stack = rv;
-	return true;
+
+	exit(failed ? 1 : 0);
 }
 
 void usage(int ec = EX_USAGE) {
 	fputs("usage elf2omf [flags] file...\n"
+		"       elf2omf [flags] @response-file\n"
 		"Flags:\n"
 			" -h               show usage\n"
 			" -v               be verbose\n"
@@ -1248,23 +809,96 @@ void usage(int ec = EX_USAGE) {
 			" -S size          specify stack segment size\n"
 			" -1               generate version 1 OMF File\n"
 			" -o file          specify outfile name\n"
-//			" -l library       specify library\n"
-//			" -L path          specify library path\n"
+			" -l library       specify library\n"
+			" -L path          specify library path\n"
 			" -t xx[:xxxx]     specify file type\n"
+			" -j jobs          number of threads used to parse input files\n"
+			" -M manifest      read input files and options from manifest\n"
+			" -d dir           search dir's symbol index for undefined symbols\n"
+			" -I dir           build a symbol index for dir and exit\n"
+			" -c dir           cache parsed objects and outputs in dir\n"
+			" -z size[:days]   limit the cache size and age\n"
+			" -i               incremental link: patch the previous output if possible\n"
+			" -s socket        run a link server listening on socket\n"
+			" -w               watch the inputs and relink when they change\n"
+			" -B batch         link every target in the batch file\n"
+			" -r               partial link: write one merged elf object\n"
+			" -x               with -r, leave out local symbols\n"
+			" -n               check only: print the segment layout as JSON\n"
 		, stderr);
 	exit(ec);
 }
 
 
 
-int main(int argc, char **argv) {
+const char getopt_options[] = "ht:o:v1CS:Xj:M:l:L:d:I:c:z:is:wB:rxn";
+
+// true if getopt would return opt for these arguments.  Flags can be
+// combined (-vs path) and an argument can follow its option directly
+// (-s/path).
+bool has_option(const std::vector<std::string> &args, char opt) {
+	for (size_t i = 1; i < args.size(); ++i) {
+		const auto &a = args[i];
+		if (a == "--") break;
+		if (a.length() < 2 || a.front() != '-') continue;
+
+		for (size_t j = 1; j < a.length(); ++j) {
+			if (a[j] == opt) return true;
+			const char *cp = a[j] == ':' ? nullptr : strchr(getopt_options, a[j]);
+			if (cp && cp[1] == ':') {
+				// the rest of the word, or the next one, is its argument.
+				if (j + 1 == a.length()) ++i;
+				break;
+			}
+		}
+	}
+	return false;
+}
+
+[[noreturn]] void link_main(int argc, char **argv) {
 
 	int ch;
 	std::string outfile;
+	std::vector<input_spec> inputs;
+	std::vector<std::string> batches;
+
+	// expand response files.
+	std::vector<std::string> args;
+	args.push_back(argv[0]);
+	for (int i = 1; i < argc; ++i)
+		expand_response_file(argv[i], args);
+
+	std::vector<char *> av;
+	av.reserve(args.size() + 1);
+	for (auto &a : args) av.push_back(&a[0]);
+	av.push_back(nullptr);
+
+	argc = args.size();
+	argv = av.data();
 
-	while ((ch = getopt(argc, argv, "ht:o:v1CS:X")) != -1) {
+	while ((ch = getopt(argc, argv, getopt_options)) != -1) {
 		switch (ch) {
+			case 'M': read_manifest(optarg, inputs); break;
+			case 'l': flags.l.emplace_back(optarg); break;
+			case 'L': flags.L.emplace_back(optarg); break;
+			case 'd': flags.d.emplace_back(optarg); break;
+			case 'I': flags.I.emplace_back(optarg); break;
+			case 'c': flags.c = optarg; break;
+			case 'i': flags.i = true; break;
+			case 's': flags.s = optarg; break;
+			case 'w': flags.w = true; break;
+			case 'B': batches.emplace_back(optarg); break;
+
+			case 'z': {
+				if (!parse_cache_limit(optarg, flags)) {
+					errx(EX_USAGE, "Invalid -z argument: %s", optarg);
+				}
+				break;
+			}
 			case 'o': flags.o = optarg; break;
+			case 'r': flags.r = true; break;
+			case 'x': flags.x = true; break;
+			case 'n': flags.n = true; break;
 			case 'v': flags.v = true; break;
 
 			case '1': flags.omf_flags |= OMF_V1; break;
@@ -1275,19 +909,26 @@ int main(int argc, char **argv) {
 
 			case 't': {
 				// -t xx[:xxxx] -- set file/auxtype.
-				if (!parse_ft(optarg)) {
+				if (!parse_ft(optarg, flags)) {
 					errx(EX_USAGE, "Invalid -t argument: %s", optarg);
 				}
 				break;
 			}
 
 			case 'S': {
-				if (!parse_stack(optarg)) {
+				if (!parse_stack(optarg, flags)) {
 					errx(EX_USAGE, "Invalid -S argument: %s", optarg);
 				}
 				break;
 			}
 
+			case 'j': {
+				if (!parse_jobs(optarg, flags)) {
+					errx(EX_USAGE, "Invalid -j argument: %s", optarg);
+				}
+				break;
+			}
+
 			default: usage();
 		}
 	}
@@ -1295,41 +936,71 @@ int main(int argc, char **argv) {
 	argv += optind;
 	argc -= optind;
 
-	if (!argc) usage();
+	for (int i = 0; i < argc; ++i) {
+		auto &spec = inputs.emplace_back();
+		spec.filename = argv[i];
+	}
 
+	if (!flags.jobs) flags.jobs = default_jobs();
 
-	if (flags.o.empty()) flags.o = "out.omf";
+	if (!flags.s.empty()) {
+		if (!inputs.empty() || resident.child) usage();
+		run_server();
+	}
 
+	if (!flags.I.empty()) {
+		if (!inputs.empty()) usage();
+		unsigned errors = 0;
+		for (const auto &dir : flags.I)
+			if (!index_directory(dir)) ++errors;
+		exit(errors ? 1 : 0);
+	}
 
-	init();
+	// batch targets start with all the other options, so read them last.
+	if (!batches.empty()) {
+		if (!inputs.empty() || resident.child || flags.w || flags.n) usage();
+		std::vector<batch_target> targets;
+		for (const auto &path : batches)
+			read_batch(path, targets);
+		if (targets.empty()) errx(EX_DATAERR, "no targets");
+
+		std::unordered_set<std::string> outputs;
+		for (const auto &t : targets) {
+			if (t.inputs.empty()) errx(EX_DATAERR, "%s: no inputs", t.options.o.c_str());
+			if (!outputs.insert(absolute_path(t.options.o)).second)
+				errx(EX_DATAERR, "%s: duplicate target", t.options.o.c_str());
+		}
+		batch_link(targets);
+	}
 
+	if (inputs.empty()) usage();
+	if (flags.n && (flags.r || flags.w)) usage();
 
-	for (int i = 0; i < argc; ++i) {
-		std::string name = argv[i];
-		if (one_file(name) < 0) ++flags.errors;
-	}
 
+	if (flags.o.empty()) flags.o = flags.r ? "out.o" : "out.omf";
 
-	// debug - dump sections
-	if (flags.v) {
-		printf("Sections:\n");
-		for (const auto &s : global_sections) {
-			printf("% 3d %-16s %ld\n", s.id, s.name.c_str(), s.data.size());
-		}
-		printf("Symbols:\n");
-		for (const auto &s : global_symbols) {
-			char m = ' ';
-			if (s.section == 0) m = '?';
-			else if (s.section == -1) m = '#'; // abs
-			printf("% 3d %c %-16s\n", s.id, m, s.name.c_str());
-		}
+	if (flags.w) {
+		if (resident.child) usage();
+#ifdef __linux__
+		watch_inputs(inputs);
+#else
+		errx(EX_USAGE, "-w requires inotify (Linux)");
+#endif
 	}
 
-	// if there are any missing symbols, search library files...
 
-	generate_linker_symbols();
-	if (!check_for_missing_symbols()) exit(1);
-	to_omf();
+	link_context context(flags);
+	context.report = [](const link_diagnostic &d){
+		warnx("%s", d.message.c_str());
+	};
+	if (resident.child) context.use_resident(&resident.objects);
+
+	add_inputs(context, inputs);
+
+	bool ok = context.link();
+	if (resident.child) resident.misses = context.parsed();
+	if (ok) context.update_cache(true);
+	if (flags.n) fputs(context.plan().c_str(), stdout);
 
 
 	// merge sections into omf segments...
@@ -1340,5 +1011,31 @@ int main(int argc, char **argv) {
 	// done!
 
 
-	exit(0);
-}
\ No newline at end of file
+	// the output couldn't be created or written.
+	int rv = ok ? 0 : 1;
+	for (const auto &d : context.diagnostics()) {
+		if (d.output == link_diagnostic::output_create) rv = EX_CANTCREAT;
+		if (d.output == link_diagnostic::output_write) rv = EX_OSERR;
+	}
+	exit(rv);
+}
+
+int main(int argc, char **argv) {
+
+	// hand the link to a resident server, if there is one.  -s is never
+	// forwarded so a server can be started with ELF2OMF_SERVER set.
+	const char *path = getenv("ELF2OMF_SERVER");
+	if (path && *path) {
+		std::vector<std::string> args;
+		args.push_back(argv[0]);
+		for (int i = 1; i < argc; ++i)
+			expand_response_file(argv[i], args);
+
+		if (!has_option(args, 's')) {
+			int rv = client_link(path, argc, argv);
+			if (rv >= 0) return rv;
+		}
+	}
+
+	link_main(argc, argv);
+}
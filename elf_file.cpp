@@ -0,0 +1,404 @@
+#include "elf_file.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cpp_lib_endian
+#include <bit>
+using std::endian;
+#else
+#include "endian.h"
+#endif
+
+#include "bswap.h"
+
+
+void throw_errno(const std::string &msg) {
+	throw std::system_error(errno, std::generic_category(), msg);
+}
+
+void throw_elf_error(const std::string &msg) {
+	throw std::runtime_error(msg);
+}
+
+void throw_elf_error() {
+	throw std::runtime_error("invalid elf file");
+}
+
+
+std::string_view string_table::operator[](uint32_t offset) const {
+	if (!valid(offset)) return std::string_view();
+
+	const char *cp = _data + offset;
+	const void *end = memchr(cp, 0, _size - offset);
+	return std::string_view(cp, end ? (const char *)end - cp : _size - offset);
+}
+
+
+static bool must_swap(const Elf32_Ehdr &header) {
+	if (endian::native == endian::little) return header.e_ident[EI_DATA] == ELFDATA2MSB;
+	if (endian::native == endian::big) return header.e_ident[EI_DATA] == ELFDATA2LSB;
+	return false;
+}
+
+// convert the header, section table and symbol/relocation tables to
+// native byte order.  A no-op unless the file is foreign-endian.
+template<endian From>
+static void to_native(uint8_t *base, size_t size) {
+
+	if constexpr (From != endian::native) {
+
+		Elf32_Ehdr &header = *(Elf32_Ehdr *)base;
+		bswap(header);
+
+		if (header.e_shentsize != sizeof(Elf32_Shdr)) return;
+		if (header.e_shoff % alignof(Elf32_Shdr)) return;
+		if (header.e_shoff > size) return;
+		if (header.e_shnum > (size - header.e_shoff) / sizeof(Elf32_Shdr)) return;
+
+		Elf32_Shdr *sections = (Elf32_Shdr *)(base + header.e_shoff);
+		bswap(sections, header.e_shnum);
+
+		for (unsigned i = 0; i < header.e_shnum; ++i) {
+			const auto &s = sections[i];
+			if (s.sh_type == SHT_NOBITS) continue;
+			if (s.sh_offset > size || s.sh_size > size - s.sh_offset) continue;
+			if (s.sh_offset % 4) continue;
+
+			uint8_t *p = base + s.sh_offset;
+			switch(s.sh_type) {
+			case SHT_SYMTAB:
+				if (s.sh_entsize == sizeof(Elf32_Sym))
+					bswap((Elf32_Sym *)p, s.sh_size / sizeof(Elf32_Sym));
+				break;
+			case SHT_REL:
+				if (s.sh_entsize == sizeof(Elf32_Rel))
+					bswap((Elf32_Rel *)p, s.sh_size / sizeof(Elf32_Rel));
+				break;
+			case SHT_RELA:
+				if (s.sh_entsize == sizeof(Elf32_Rela))
+					bswap((Elf32_Rela *)p, s.sh_size / sizeof(Elf32_Rela));
+				break;
+			}
+		}
+	}
+}
+
+
+static void advise(const uint8_t *data, size_t offset, size_t length) {
+	// madvise wants a page-aligned address.
+	static const size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = offset & ~(page - 1);
+	posix_madvise((void *)(data + start), length + (offset - start), POSIX_MADV_WILLNEED);
+}
+
+static void summarize(const uint8_t *data, size_t size, const Elf32_Ehdr &header, const std::vector<Elf32_Shdr> &sections, elf_summary &summary) {
+
+	// sizes are untrusted until the real parse; anything past the end of
+	// the file is left out (and the parse will reject it).
+	auto in_file = [size](const Elf32_Shdr &s){
+		return s.sh_offset <= size && s.sh_size <= size - s.sh_offset;
+	};
+
+	const char *names = nullptr;
+	size_t names_size = 0;
+	if (header.e_shstrndx < sections.size()) {
+		const auto &s = sections[header.e_shstrndx];
+		if (!in_file(s)) return;
+		names = (const char *)data + s.sh_offset;
+		names_size = s.sh_size;
+	}
+	string_table strings(names, names_size);
+
+	std::vector<int> index(sections.size(), -1);
+	for (unsigned i = 0; i < sections.size(); ++i) {
+		const auto &s = sections[i];
+		if (s.sh_type == SHT_PROGBITS || s.sh_type == SHT_NOBITS) {
+			index[i] = summary.sections.size();
+			auto &tmp = summary.sections.emplace_back();
+			tmp.name = strings[s.sh_name];
+		}
+		if (s.sh_type == SHT_SYMTAB && s.sh_entsize == sizeof(Elf32_Sym) && in_file(s)) {
+			unsigned count = s.sh_size / sizeof(Elf32_Sym);
+			summary.symbols += count;
+			// sh_info is one greater than the last local symbol.
+			summary.local_symbols += std::min(count, s.sh_info);
+		}
+	}
+
+	for (const auto &s : sections) {
+		if (s.sh_type != SHT_REL && s.sh_type != SHT_RELA) continue;
+		if (!s.sh_entsize || s.sh_info >= sections.size() || !in_file(s)) continue;
+		if (index[s.sh_info] < 0) continue;
+		summary.sections[index[s.sh_info]].relocs += s.sh_size / s.sh_entsize;
+	}
+	summary.valid = true;
+}
+
+void prefetch_elf(const uint8_t *data, size_t size, elf_summary *summary, bool payload) {
+
+	Elf32_Ehdr header;
+	if (size < sizeof(header)) return;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.e_ident, ELFMAG, SELFMAG)) return;
+
+	bool swap = must_swap(header);
+	if (swap) bswap(header);
+
+	if (header.e_shentsize != sizeof(Elf32_Shdr)) return;
+	if (header.e_shnum == 0) return;
+	if (header.e_shoff >= size) return;
+	if (header.e_shnum * sizeof(Elf32_Shdr) > size - header.e_shoff) return;
+
+	// (the table itself may not be aligned.)
+	std::vector<Elf32_Shdr> sections(header.e_shnum);
+	memcpy(sections.data(), data + header.e_shoff, header.e_shnum * sizeof(Elf32_Shdr));
+
+	// (offset, end) of everything we'll read, merged so it's one request
+	// per contiguous run.
+	std::vector<std::pair<size_t, size_t>> extents;
+	extents.reserve(header.e_shnum);
+	for (auto &s : sections) {
+		if (swap) bswap(s);
+		switch(s.sh_type) {
+		case SHT_PROGBITS:
+			if (!payload) break;
+			// fallthrough
+		case SHT_SYMTAB:
+		case SHT_STRTAB:
+		case SHT_REL:
+		case SHT_RELA:
+			if (s.sh_size && s.sh_offset < size)
+				extents.emplace_back(s.sh_offset, std::min((size_t)s.sh_offset + s.sh_size, size));
+			break;
+		}
+	}
+
+	if (!extents.empty()) {
+		std::sort(extents.begin(), extents.end());
+
+		auto current = extents.front();
+		for (const auto &e : extents) {
+			// small gaps are cheaper to read than to skip.
+			if (e.first <= current.second + 4096) {
+				current.second = std::max(current.second, e.second);
+				continue;
+			}
+			advise(data, current.first, current.second - current.first);
+			current = e;
+		}
+		advise(data, current.first, current.second - current.first);
+	}
+
+	if (summary) summarize(data, size, header, sections, *summary);
+}
+
+
+elf_file::elf_file(int fd) {
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) throw_errno("fstat");
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		// private + writable so foreign-endian tables can be swapped in place.
+		void *vp = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (vp != MAP_FAILED) {
+			_base = (uint8_t *)vp;
+			_size = st.st_size;
+			_mapped = true;
+		}
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		if (!load_stream(fd)) throw_elf_error();
+		return;
+	}
+
+	if (!_mapped) {
+		// fall back to reading it.
+		if (lseek(fd, 0, SEEK_SET) < 0) throw_errno("lseek");
+		for(;;) {
+			size_t size = _buffer.size();
+			_buffer.resize(size + 4096);
+			ssize_t ok = read(fd, _buffer.data() + size, 4096);
+			if (ok < 0) {
+				if (errno == EINTR) { _buffer.resize(size); continue; }
+				throw_errno("read");
+			}
+			_buffer.resize(size + ok);
+			if (ok == 0) break;
+		}
+		_base = _buffer.data();
+		_size = _buffer.size();
+	}
+
+	try {
+		init();
+	} catch (...) {
+		if (_mapped) munmap(_base, _size);
+		throw;
+	}
+}
+
+elf_file::elf_file(const uint8_t *data, size_t size, std::shared_ptr<void> owner) {
+
+	if (size < sizeof(Elf32_Ehdr)) throw_elf_error();
+
+	// archive members are only 2-byte aligned.
+	bool copy = (uintptr_t)data % 8;
+	if (must_swap(*(const Elf32_Ehdr *)data)) copy = true;
+
+	if (copy) {
+		_buffer.assign(data, data + size);
+		_base = _buffer.data();
+	} else {
+		_base = const_cast<uint8_t *>(data); // never written
+		_owner = std::move(owner);
+	}
+	_size = size;
+	init();
+}
+
+elf_file::~elf_file() {
+	if (_mapped) munmap(_base, _size);
+}
+
+
+// read until size bytes or end of file.
+static size_t read_fully(int fd, uint8_t *buffer, size_t size) {
+	size_t total = 0;
+	while (total < size) {
+		ssize_t ok = read(fd, buffer + total, size - total);
+		if (ok < 0) {
+			if (errno == EINTR) continue;
+			throw_errno("read");
+		}
+		if (ok == 0) break;
+		total += ok;
+	}
+	return total;
+}
+
+static void skip_fully(int fd, size_t size) {
+	uint8_t tmp[4096];
+	while (size) {
+		size_t count = std::min(size, sizeof(tmp));
+		if (read_fully(fd, tmp, count) != count) throw_elf_error();
+		size -= count;
+	}
+}
+
+std::unique_ptr<elf_file> elf_file::read_stream(int fd) {
+	std::unique_ptr<elf_file> rv(new elf_file);
+	if (!rv->load_stream(fd)) return nullptr;
+	return rv;
+}
+
+bool elf_file::load_stream(int fd) {
+
+	// the section table is (usually) at the end and everything else is
+	// referenced from it, so buffer everything up to the end of the table,
+	// then read the rest of the sections we need and skip the remainder of
+	// this object so the stream is positioned at the next one.
+
+	Elf32_Ehdr header;
+	size_t ok = read_fully(fd, (uint8_t *)&header, sizeof(header));
+	if (ok == 0) return false;
+	if (ok != sizeof(header)) throw_elf_error();
+	if (memcmp(header.e_ident, ELFMAG, SELFMAG)) throw_elf_error();
+
+	bool swap = must_swap(header);
+	Elf32_Ehdr tmp = header;
+	if (swap) bswap(tmp);
+
+	if (tmp.e_shnum == 0 || tmp.e_shentsize != sizeof(Elf32_Shdr)) throw_elf_error();
+	if (tmp.e_shoff < sizeof(Elf32_Ehdr)) throw_elf_error();
+
+	size_t table_end = (size_t)tmp.e_shoff + tmp.e_shnum * sizeof(Elf32_Shdr);
+
+	_buffer.resize(table_end);
+	memcpy(_buffer.data(), &header, sizeof(header));
+	ok = read_fully(fd, _buffer.data() + sizeof(header), table_end - sizeof(header));
+	if (ok != table_end - sizeof(header)) throw_elf_error();
+
+	size_t needed_end = table_end;
+	size_t object_end = table_end;
+	for (unsigned i = 0; i < tmp.e_shnum; ++i) {
+		Elf32_Shdr s;
+		memcpy(&s, _buffer.data() + tmp.e_shoff + i * sizeof(Elf32_Shdr), sizeof(s));
+		if (swap) bswap(s);
+
+		if (s.sh_type == SHT_NOBITS || s.sh_type == SHT_NULL) continue;
+		size_t end = (size_t)s.sh_offset + s.sh_size;
+		object_end = std::max(object_end, end);
+
+		switch(s.sh_type) {
+		case SHT_PROGBITS:
+		case SHT_SYMTAB:
+		case SHT_STRTAB:
+		case SHT_REL:
+		case SHT_RELA:
+			needed_end = std::max(needed_end, end);
+			break;
+		}
+	}
+
+	if (needed_end > table_end) {
+		_buffer.resize(needed_end);
+		ok = read_fully(fd, _buffer.data() + table_end, needed_end - table_end);
+		if (ok != needed_end - table_end) throw_elf_error();
+	}
+	skip_fully(fd, object_end - needed_end);
+
+	_base = _buffer.data();
+	_size = _buffer.size();
+	init();
+	return true;
+}
+
+void elf_file::init() {
+
+	if (_size < sizeof(Elf32_Ehdr)) throw_elf_error();
+
+	Elf32_Ehdr &header = *(Elf32_Ehdr *)_base;
+	if (memcmp(header.e_ident, ELFMAG, SELFMAG)) throw_elf_error();
+
+	switch(header.e_ident[EI_DATA]) {
+	case ELFDATA2LSB: to_native<endian::little>(_base, _size); break;
+	case ELFDATA2MSB: to_native<endian::big>(_base, _size); break;
+	}
+
+	if (header.e_shnum && header.e_shentsize != sizeof(Elf32_Shdr)) throw_elf_error();
+	if (header.e_shoff % alignof(Elf32_Shdr)) throw_elf_error();
+	if (header.e_shoff > _size) throw_elf_error();
+	if (header.e_shnum > (_size - header.e_shoff) / sizeof(Elf32_Shdr)) throw_elf_error();
+
+	_header = &header;
+	_sections = (const Elf32_Shdr *)(_base + header.e_shoff);
+}
+
+
+view<uint8_t> elf_file::data(const Elf32_Shdr &section) const {
+
+	if (section.sh_type == SHT_NOBITS || section.sh_size == 0) return view<uint8_t>();
+
+	if (section.sh_offset > _size || section.sh_size > _size - section.sh_offset)
+		throw_elf_error();
+
+	return view<uint8_t>(_base + section.sh_offset, section.sh_size);
+}
+
+string_table elf_file::strings(const Elf32_Shdr &section) const {
+	auto tmp = data(section);
+	return string_table((const char *)tmp.data(), tmp.size());
+}
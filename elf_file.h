@@ -0,0 +1,184 @@
+#ifndef __elf_file_h__
+#define __elf_file_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "elf32.h"
+
+
+void throw_errno(const std::string &msg);
+void throw_elf_error(const std::string &msg);
+void throw_elf_error();
+
+
+// read-only, bounds-checked window into an elf_file.
+template<class T>
+class view {
+
+	const T *_data = nullptr;
+	size_t _size = 0;
+
+public:
+
+	view() = default;
+	view(const T *data, size_t size) : _data(data), _size(size) {}
+
+	const T *begin() const { return _data; }
+	const T *end() const { return _data + _size; }
+	const T *data() const { return _data; }
+
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+	const T &operator[](size_t i) const { return _data[i]; }
+	const T &at(size_t i) const {
+		if (i >= _size) throw_elf_error("index out of range");
+		return _data[i];
+	}
+};
+
+
+// string table.  out of range offsets return an empty string.
+class string_table {
+
+	const char *_data = nullptr;
+	size_t _size = 0;
+
+public:
+
+	string_table() = default;
+	string_table(const char *data, size_t size) : _data(data), _size(size) {}
+
+	size_t size() const { return _size; }
+
+	bool valid(uint32_t offset) const { return offset && offset < _size; }
+
+	std::string_view operator[](uint32_t offset) const;
+};
+
+
+// table sizes of an elf file, from the section headers alone.
+struct elf_summary {
+	bool valid = false;
+	unsigned symbols = 0;
+	unsigned local_symbols = 0;
+
+	struct section {
+		std::string name;
+		unsigned relocs = 0;
+	};
+	std::vector<section> sections; // SHT_PROGBITS and SHT_NOBITS only
+};
+
+/*
+ * Start asynchronous reads of the parts of a mapped elf file that will
+ * be needed (section table, section data, symbol, string and relocation
+ * tables) so they're already resident when it's parsed.  This never
+ * fails; anything unexpected is left for elf_file to report.  If summary
+ * is provided, it's filled in from the section table.  The section data
+ * is skipped unless payload is set.
+ */
+void prefetch_elf(const uint8_t *data, size_t size, elf_summary *summary = nullptr, bool payload = true);
+
+
+/*
+ * An elf file, mapped into memory once.  The header, section table,
+ * symbol tables and relocation tables are converted to native byte order
+ * when the file is opened; everything else is a view into the mapping.
+ *
+ * Pipes and other streams can't be mapped or seeked so objects are read
+ * sequentially into a buffer which only extends as far as the last
+ * section we actually use.
+ */
+class elf_file {
+
+	uint8_t *_base = nullptr;
+	size_t _size = 0;
+	bool _mapped = false;
+	std::vector<uint8_t> _buffer; // used if the file can't be mapped
+	std::shared_ptr<void> _owner; // for files inside another mapping
+
+	const Elf32_Ehdr *_header = nullptr;
+	const Elf32_Shdr *_sections = nullptr;
+
+	elf_file() = default;
+
+	void init();
+	bool load_stream(int fd);
+
+public:
+
+	// fd may be closed once the constructor returns.
+	explicit elf_file(int fd);
+
+	// an object embedded in a larger mapping (an archive member).  owner
+	// keeps the mapping alive.  The mapping is never modified; misaligned
+	// and foreign-endian objects are copied.
+	elf_file(const uint8_t *data, size_t size, std::shared_ptr<void> owner);
+
+	~elf_file();
+
+	// read the next object from a pipe or stream.  Returns nullptr at end of file.
+	static std::unique_ptr<elf_file> read_stream(int fd);
+
+	elf_file(const elf_file &) = delete;
+	elf_file &operator=(const elf_file &) = delete;
+
+	const Elf32_Ehdr &header() const { return *_header; }
+	view<Elf32_Shdr> sections() const { return view<Elf32_Shdr>(_sections, _header->e_shnum); }
+
+	view<uint8_t> data(const Elf32_Shdr &section) const;
+	string_table strings(const Elf32_Shdr &section) const;
+
+	template<class T>
+	view<T> table(const Elf32_Shdr &section) const {
+		if (section.sh_size == 0) return view<T>();
+		if (section.sh_entsize != sizeof(T)) throw_elf_error("unexpected entry size");
+
+		auto tmp = data(section);
+		if ((uintptr_t)tmp.data() % alignof(T)) throw_elf_error("misaligned table");
+		return view<T>((const T *)tmp.data(), tmp.size() / sizeof(T));
+	}
+};
+
+
+// decodes SHT_REL and SHT_RELA entries directly from the elf_file.
+class reloc_cursor {
+
+	const void *_data = nullptr;
+	size_t _size = 0;
+	bool _rela = false;
+
+public:
+
+	reloc_cursor() = default;
+	reloc_cursor(const Elf32_Rela *data, size_t size) : _data(data), _size(size), _rela(true) {}
+	reloc_cursor(const elf_file &file, const Elf32_Shdr &section) {
+		_rela = section.sh_type == SHT_RELA;
+		if (_rela) {
+			auto tmp = file.table<Elf32_Rela>(section);
+			_data = tmp.data();
+			_size = tmp.size();
+		} else {
+			auto tmp = file.table<Elf32_Rel>(section);
+			_data = tmp.data();
+			_size = tmp.size();
+		}
+	}
+
+	size_t size() const { return _size; }
+
+	Elf32_Rela operator[](size_t i) const {
+		if (_rela) return ((const Elf32_Rela *)_data)[i];
+
+		const Elf32_Rel &r = ((const Elf32_Rel *)_data)[i];
+		return Elf32_Rela{ r.r_offset, r.r_info, 0 };
+	}
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "elf_writer.h"
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef __cpp_lib_endian
+#include <bit>
+using std::endian;
+#else
+#include "endian.h"
+#endif
+
+#include "bswap.h"
+
+
+namespace {
+
+	// the string table, shared by section and symbol names.
+	class string_pool {
+		std::vector<uint8_t> _data{0};
+		std::unordered_map<std::string, uint32_t> _map;
+
+	public:
+		uint32_t add(const std::string &s) {
+			if (s.empty()) return 0;
+			auto iter = _map.find(s);
+			if (iter != _map.end()) return iter->second;
+
+			uint32_t offset = _data.size();
+			_data.insert(_data.end(), s.begin(), s.end());
+			_data.push_back(0);
+			_map.emplace(s, offset);
+			return offset;
+		}
+
+		const std::vector<uint8_t> &data() const { return _data; }
+	};
+
+	template<class T>
+	void to_little(T &x) {
+		if constexpr (endian::native != endian::little) bswap(x);
+	}
+
+	// append, 4-byte aligned (so the tables can be used in place).  Returns the offset.
+	uint32_t append(std::vector<uint8_t> &out, const void *data, size_t size) {
+		out.resize((out.size() + 3) & ~3);
+		uint32_t offset = out.size();
+		out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+		return offset;
+	}
+
+	std::string rela_name(const std::string &name) {
+		if (!name.empty() && name.front() == '.') return ".rela" + name;
+		return ".rela." + name;
+	}
+}
+
+
+std::vector<uint8_t> elf_image(const std::vector<elf::section> &sections, const std::vector<elf::symbol> &symbols) {
+
+	std::vector<uint8_t> image(sizeof(Elf32_Ehdr));
+	std::vector<Elf32_Shdr> headers(1);
+	string_pool strings;
+
+	// the merged sections are numbered from 1, as symbols expect.
+	for (const auto &s : sections) {
+		auto &h = headers.emplace_back();
+		memset(&h, 0, sizeof(h));
+		h.sh_name = strings.add(s.name);
+		h.sh_type = s.type;
+		h.sh_flags = s.flags;
+		h.sh_addralign = s.align;
+		if (s.type == SHT_NOBITS) {
+			h.sh_offset = image.size();
+			h.sh_size = s.size;
+		} else {
+			h.sh_offset = append(image, s.data.data(), s.data.size());
+			h.sh_size = s.data.size();
+		}
+	}
+
+	unsigned symtab_index = headers.size();
+	unsigned strtab_index = symtab_index + 1;
+	for (const auto &s : sections)
+		if (!s.relocs.empty()) ++strtab_index;
+
+	{
+		std::vector<Elf32_Sym> table(symbols.size() + 1);
+		memset(table.data(), 0, table.size() * sizeof(Elf32_Sym));
+
+		unsigned first_global = 1;
+		for (size_t i = 0; i < symbols.size(); ++i) {
+			const auto &x = symbols[i];
+			auto &sym = table[i + 1];
+			sym.st_name = strings.add(x.name);
+			sym.st_value = x.value;
+			sym.st_info = ELF32_ST_INFO(x.bind, x.type);
+			sym.st_shndx = x.shndx;
+			if (x.bind == STB_LOCAL) first_global = i + 2;
+			to_little(sym);
+		}
+
+		auto &h = headers.emplace_back();
+		memset(&h, 0, sizeof(h));
+		h.sh_name = strings.add(".symtab");
+		h.sh_type = SHT_SYMTAB;
+		h.sh_offset = append(image, table.data(), table.size() * sizeof(Elf32_Sym));
+		h.sh_size = table.size() * sizeof(Elf32_Sym);
+		h.sh_link = strtab_index;
+		h.sh_info = first_global;
+		h.sh_addralign = 4;
+		h.sh_entsize = sizeof(Elf32_Sym);
+	}
+
+	for (size_t i = 0; i < sections.size(); ++i) {
+		const auto &s = sections[i];
+		if (s.relocs.empty()) continue;
+
+		std::vector<Elf32_Rela> table(s.relocs);
+		for (auto &r : table) to_little(r);
+
+		auto &h = headers.emplace_back();
+		memset(&h, 0, sizeof(h));
+		h.sh_name = strings.add(rela_name(s.name));
+		h.sh_type = SHT_RELA;
+		h.sh_flags = SHF_INFO_LINK;
+		h.sh_offset = append(image, table.data(), table.size() * sizeof(Elf32_Rela));
+		h.sh_size = table.size() * sizeof(Elf32_Rela);
+		h.sh_link = symtab_index;
+		h.sh_info = i + 1;
+		h.sh_addralign = 4;
+		h.sh_entsize = sizeof(Elf32_Rela);
+	}
+
+	{
+		auto &h = headers.emplace_back();
+		memset(&h, 0, sizeof(h));
+		h.sh_name = strings.add(".strtab");
+		h.sh_type = SHT_STRTAB;
+		h.sh_offset = append(image, strings.data().data(), strings.data().size());
+		h.sh_size = strings.data().size();
+		h.sh_addralign = 1;
+	}
+
+	Elf32_Ehdr header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.e_ident, ELFMAG, SELFMAG);
+	header.e_ident[EI_CLASS] = ELFCLASS32;
+	header.e_ident[EI_DATA] = ELFDATA2LSB;
+	header.e_ident[EI_VERSION] = EV_CURRENT;
+	header.e_type = ET_REL;
+	header.e_machine = EM_65816;
+	header.e_version = EV_CURRENT;
+	header.e_ehsize = sizeof(Elf32_Ehdr);
+	header.e_shentsize = sizeof(Elf32_Shdr);
+	header.e_shnum = headers.size();
+	header.e_shstrndx = headers.size() - 1;
+
+	for (auto &h : headers) to_little(h);
+	header.e_shoff = append(image, headers.data(), headers.size() * sizeof(Elf32_Shdr));
+
+	to_little(header);
+	memcpy(image.data(), &header, sizeof(header));
+	return image;
+}
+
+void save_elf(int fd, const std::vector<elf::section> &sections, const std::vector<elf::symbol> &symbols) {
+
+	auto image = elf_image(sections, symbols);
+
+	size_t offset = 0;
+	while (offset < image.size()) {
+		ssize_t ok = write(fd, image.data() + offset, image.size() - offset);
+		if (ok < 0) {
+			if (errno == EINTR) continue;
+			throw std::system_error(errno, std::generic_category(), "write");
+		}
+		offset += ok;
+	}
+}
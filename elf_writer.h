@@ -0,0 +1,43 @@
+#ifndef __elf_writer_h__
+#define __elf_writer_h__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "elf32.h"
+
+/*
+ * A relocatable (ET_REL) 65816 elf object, as written by -r.  The file is
+ * little-endian and has one string table, which is also the section name
+ * table, so any elf reader (including ours) can read it back.
+ */
+namespace elf {
+
+	struct section {
+		std::string name;
+		uint32_t type = SHT_PROGBITS; // or SHT_NOBITS
+		uint32_t flags = 0;
+		uint32_t align = 0;
+		uint32_t size = 0; // SHT_NOBITS
+		std::vector<uint8_t> data;
+
+		// r_info uses symbol numbers counted from 1 (0 is the null symbol).
+		std::vector<Elf32_Rela> relocs;
+	};
+
+	struct symbol {
+		std::string name; // empty for section symbols
+		uint8_t bind = STB_GLOBAL;
+		uint8_t type = STT_NOTYPE;
+		uint16_t shndx = SHN_UNDEF; // sections are counted from 1, or SHN_ABS
+		uint32_t value = 0;
+	};
+}
+
+// symbols must be ordered locals first.  save_elf writes to fd (which
+// isn't closed).  These throw std::system_error on failure.
+void save_elf(int fd, const std::vector<elf::section> &sections, const std::vector<elf::symbol> &symbols);
+std::vector<uint8_t> elf_image(const std::vector<elf::section> &sections, const std::vector<elf::symbol> &symbols);
+
+#endif
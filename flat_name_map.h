@@ -0,0 +1,193 @@
+#ifndef __flat_name_map_h__
+#define __flat_name_map_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FLAT_NAME_MAP_SSE2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define FLAT_NAME_MAP_NEON 1
+#endif
+
+#include "string_pool.h"
+
+/*
+ * Name -> id (symbol or section number) table for the link.  Open
+ * addressing, laid out like a swiss table: each slot has a control byte,
+ * either empty (0x80) or the top 7 bits of the name's hash, and the
+ * control bytes are probed 16 (one group) at a time, with SSE2 or NEON
+ * where available.  Slots keep the full hash so a probe only compares
+ * names which almost certainly match and growing never hashes a name
+ * again.
+ *
+ * The capacity is a power of two, at most 7/8 full.  Names are never
+ * removed, so there are no tombstones.  The names must outlive the map.
+ */
+class flat_name_map {
+
+public:
+
+	struct slot {
+		hashed_name key;
+		int value;
+	};
+
+private:
+
+	static constexpr size_t group_size = 16;
+	static constexpr uint8_t empty_tag = 0x80;
+
+	std::unique_ptr<uint8_t[]> _control;
+	std::unique_ptr<slot[]> _slots;
+	size_t _groups = 0; // power of 2, or 0
+	size_t _size = 0;
+
+	static uint8_t tag(size_t hash) {
+		return (hash >> (sizeof(size_t) * 8 - 7)) & 0x7f;
+	}
+
+	// a set of slots in a group.  NEON has no movemask, so there it's 4
+	// bits per slot (the narrowed compare), with only the top one kept.
+#if FLAT_NAME_MAP_NEON
+	typedef uint64_t mask_type;
+	static constexpr unsigned mask_shift = 2;
+#else
+	typedef unsigned mask_type;
+	static constexpr unsigned mask_shift = 0;
+#endif
+
+	// slot i is in the set if control[i] == x.
+	static mask_type match(const uint8_t *control, uint8_t x) {
+#if FLAT_NAME_MAP_SSE2
+		__m128i group = _mm_loadu_si128((const __m128i *)control);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)x)));
+#elif FLAT_NAME_MAP_NEON
+		uint8x16_t eq = vceqq_u8(vld1q_u8(control), vdupq_n_u8(x));
+		uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull;
+#else
+		mask_type rv = 0;
+		for (unsigned i = 0; i < group_size; ++i)
+			if (control[i] == x) rv |= (mask_type)1 << i;
+		return rv;
+#endif
+	}
+
+	static mask_type match_empty(const uint8_t *control) {
+#if FLAT_NAME_MAP_SSE2
+		// only empty has the high bit set.
+		return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)control));
+#else
+		return match(control, empty_tag);
+#endif
+	}
+
+	static unsigned next_bit(mask_type &mask) {
+		unsigned i = __builtin_ctzll(mask) >> mask_shift;
+		mask &= mask - 1;
+		return i;
+	}
+
+	// groups are probed triangularly (1, 2, 3... apart) which, with a
+	// power of 2 number of groups, visits every group.  Stops at the first
+	// group with an empty slot.
+	slot *lookup(const hashed_name &key) const {
+		uint8_t t = tag(key.hash);
+		size_t g = key.hash & (_groups - 1);
+		for (size_t step = 1; ; ++step) {
+			const uint8_t *control = _control.get() + g * group_size;
+
+			for (mask_type m = match(control, t); m; ) {
+				slot &s = _slots[g * group_size + next_bit(m)];
+				if (s.key == key) return &s;
+			}
+			if (match_empty(control)) return nullptr;
+
+			g = (g + step) & (_groups - 1);
+		}
+	}
+
+	// the first empty slot for hash.  There must be one.
+	size_t free_slot(size_t hash) const {
+		size_t g = hash & (_groups - 1);
+		for (size_t step = 1; ; ++step) {
+			if (mask_type m = match_empty(_control.get() + g * group_size))
+				return g * group_size + next_bit(m);
+			g = (g + step) & (_groups - 1);
+		}
+	}
+
+	void rehash(size_t groups) {
+		auto control = std::move(_control);
+		auto slots = std::move(_slots);
+		size_t capacity = _groups * group_size;
+
+		_groups = groups;
+		_control.reset(new uint8_t[groups * group_size]);
+		_slots.reset(new slot[groups * group_size]);
+		memset(_control.get(), empty_tag, groups * group_size);
+
+		for (size_t i = 0; i < capacity; ++i) {
+			if (control[i] == empty_tag) continue;
+			size_t j = free_slot(slots[i].key.hash);
+			_control[j] = control[i];
+			_slots[j] = slots[i];
+		}
+	}
+
+	static size_t groups_for(size_t size) {
+		size_t groups = 1;
+		while (groups * group_size * 7 / 8 < size) groups <<= 1;
+		return groups;
+	}
+
+public:
+
+	flat_name_map() = default;
+
+	flat_name_map(const flat_name_map &) = delete;
+	flat_name_map &operator=(const flat_name_map &) = delete;
+
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+	// room for size names without growing.
+	void reserve(size_t size) {
+		size_t groups = groups_for(size);
+		if (groups > _groups) rehash(groups);
+	}
+
+	// the id, or nullptr.
+	int *find(const hashed_name &key) {
+		if (!_size) return nullptr;
+		slot *s = lookup(key);
+		return s ? &s->value : nullptr;
+	}
+
+	const int *find(const hashed_name &key) const {
+		return const_cast<flat_name_map *>(this)->find(key);
+	}
+
+	// adds key -> value unless key is already there.  Returns the id and
+	// whether it was added.
+	std::pair<int *, bool> emplace(const hashed_name &key, int value) {
+		if (int *p = find(key)) return { p, false };
+
+		if (_size + 1 > _groups * group_size * 7 / 8)
+			rehash(_groups ? _groups * 2 : 1);
+
+		size_t i = free_slot(key.hash);
+		_control[i] = tag(key.hash);
+		_slots[i] = slot{ key, value };
+		++_size;
+		return { &_slots[i].value, true };
+	}
+};
+
+#endif
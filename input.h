@@ -0,0 +1,41 @@
+#ifndef __input_h__
+#define __input_h__
+
+#include <stdint.h>
+#include <string_view>
+
+#include "elf_file.h"
+
+// merged section types.
+enum {
+	TYPE_CODE = 1,
+	TYPE_DATA,
+	TYPE_CDATA,
+	TYPE_BSS
+};
+
+// one elf section (or omf segment), as seen by the merge.  Names point
+// into the input (its string table, cache entry or decoded omf object),
+// which is kept for the whole link.
+struct input_section {
+	std::string_view name;
+	unsigned type = 0; // TYPE_*, 0 if not merged
+	uint32_t align = 0;
+	uint32_t size = 0;
+	view<uint8_t> data;
+};
+
+struct input_symbol {
+	std::string_view name;
+	bool named = false;
+	unsigned bind = 0;
+	unsigned shndx = 0;
+	uint32_t value = 0;
+};
+
+struct input_relocs {
+	unsigned section = 0; // associated data section
+	reloc_cursor relocs;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "journal.h"
+#include "version.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <cstdio>
+
+#include <unistd.h>
+
+/*
+ * Text, one record per line.  Paths come last so they may contain spaces.
+ *
+ *   elf2omf-journal <version>
+ *   options <options>
+ *   output <size> <sec> <nsec>
+ *   library <hash> <path>
+ *   input <hash|-> <signature> <ranges> <path>
+ *   range <offset> <size>
+ */
+
+static const char journal_magic[] = "elf2omf-journal";
+
+std::string link_journal::path(const std::string &output) {
+	return output + ".journal";
+}
+
+// rest of the line, after one separating space.
+static std::string rest(std::istringstream &ss) {
+	std::string rv;
+	if (ss.get() != ' ') return rv;
+	std::getline(ss, rv);
+	return rv;
+}
+
+bool link_journal::read(const std::string &path) {
+
+	std::ifstream in(path);
+	if (!in) return false;
+
+	*this = link_journal();
+
+	std::string line;
+	if (!std::getline(in, line) || line != std::string(journal_magic) + " " ELF2OMF_VERSION)
+		return false;
+
+	unsigned ranges = 0;
+	while (std::getline(in, line)) {
+		std::istringstream ss(line);
+		std::string tag;
+		ss >> tag;
+
+		if (ranges) {
+			if (tag != "range") return false;
+			uint32_t offset, size;
+			if (!(ss >> offset >> size)) return false;
+			inputs.back().ranges.emplace_back(offset, size);
+			--ranges;
+			continue;
+		}
+
+		if (tag == "options") {
+			options = rest(ss);
+		} else if (tag == "output") {
+			if (!(ss >> output.size >> output.sec >> output.nsec)) return false;
+		} else if (tag == "library") {
+			uint64_t hash;
+			if (!(ss >> std::hex >> hash)) return false;
+			libraries.emplace_back(rest(ss), hash);
+		} else if (tag == "input") {
+			auto &i = inputs.emplace_back();
+			std::string hash;
+			if (!(ss >> hash >> std::hex >> i.signature >> std::dec >> ranges)) return false;
+			if (hash == "-") i.missing = true;
+			else i.hash = std::stoull(hash, nullptr, 16);
+			i.filename = rest(ss);
+		} else {
+			return false;
+		}
+	}
+	return ranges == 0 && in.eof();
+}
+
+bool link_journal::write(const std::string &path) const {
+
+	std::string tmp = path + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (!fp) return false;
+
+	fprintf(fp, "%s %s\n", journal_magic, ELF2OMF_VERSION);
+	fprintf(fp, "options %s\n", options.c_str());
+	fprintf(fp, "output %llu %lld %lld\n", (unsigned long long)output.size,
+		(long long)output.sec, (long long)output.nsec);
+
+	for (const auto &l : libraries)
+		fprintf(fp, "library %016llx %s\n", (unsigned long long)l.second, l.first.c_str());
+
+	for (const auto &i : inputs) {
+		if (i.missing) fprintf(fp, "input -");
+		else fprintf(fp, "input %016llx", (unsigned long long)i.hash);
+		fprintf(fp, " %016llx %zu %s\n", (unsigned long long)i.signature, i.ranges.size(), i.filename.c_str());
+		for (const auto &r : i.ranges)
+			fprintf(fp, "range %u %u\n", r.first, r.second);
+	}
+
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0) ok = false;
+	if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
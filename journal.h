@@ -0,0 +1,41 @@
+#ifndef __journal_h__
+#define __journal_h__
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "symbol_index.h"
+
+/*
+ * Layout journal for incremental links (-i), kept next to the output.
+ * It records what the output was built from and where each input's
+ * section data ended up in the file, so an input whose contents changed
+ * but whose layout didn't can be patched in place.
+ */
+struct link_journal {
+
+	struct input {
+		std::string filename;
+		bool missing = false; // optional input that didn't exist
+		uint64_t hash = 0; // contents
+		uint64_t signature = 0; // everything but the section data
+
+		// file offset and size of each section's data, in section order.
+		std::vector<std::pair<uint32_t, uint32_t>> ranges;
+	};
+
+	std::string options;
+	symbol_index::stamp output;
+	std::vector<std::pair<std::string, uint64_t>> libraries;
+	std::vector<input> inputs;
+
+	static std::string path(const std::string &output);
+
+	// false if the journal is missing or invalid.
+	bool read(const std::string &path);
+	bool write(const std::string &path) const;
+};
+
+#endif
@@ -0,0 +1,2591 @@
+#include "link_context.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <climits>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#include "archive.h"
+#include "elf32.h"
+#include "elf_file.h"
+#include "elf_writer.h"
+#include "flat_name_map.h"
+#include "journal.h"
+#include "object_cache.h"
+#include "omf.h"
+#include "omf_input.h"
+#include "scratch_pool.h"
+#include "string_pool.h"
+#include "version.h"
+#include "worker_pool.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static_assert(sizeof(Elf32_Ehdr) == 0x34, "Invalid size for Elf32_Ehdr");
+static_assert(sizeof(Elf32_Shdr) == 0x28, "Invalid size for Elf32_Shdr");
+static_assert(sizeof(Elf32_Sym) == 16, "Invalid size for Elf32_Sym");
+static_assert(sizeof(Elf32_Rel) == 8, "Invalid size for Elf32_Rel");
+static_assert(sizeof(Elf32_Rela) == 12, "Invalid size for Elf32_Rela");
+
+/*
+
+
+ for now (small memory model - 1 segment)
+ - merge all progbits
+ - merge all bss
+
+ - registers, tiny, ztiny merged together into direct page/stack segment
+
+put bss/ds at the end (could use )
+
+
+future
+ - in omf, mark non-read-only segments as needing reload.
+
+ */
+
+
+// everything here is private to the link.
+namespace {
+
+	struct reloc {
+		unsigned offset = 0;
+		unsigned value = 0;
+
+		int symbol = 0;
+		unsigned type = 0;
+	};
+
+
+
+	struct symbol {
+		std::string_view name; // in the string pool (globals) or the input (locals)
+		int id = 0;
+
+		// uint8_t type = 0;
+		// uint8_t flags = 0;
+		uint32_t offset = 0;
+		int section = 0;
+		unsigned count = 0; // number of references
+		bool local = false;
+		bool absolute = false;
+		bool weak = false;
+	};
+
+	enum {
+		REGION_DP = 1,
+		REGION_NEAR,
+		REGION_FAR,
+		REGION_HUGE,
+	};
+
+	// a piece of an input file that belongs to a merged section.
+	struct fragment {
+		uint32_t offset = 0;
+		view<uint8_t> data;
+	};
+
+	// this is our *merged* section, not an elf section
+	struct section {
+		std::string_view name; // in the string pool
+		int id = 0;
+
+		uint32_t align = 0;
+
+		unsigned type = 0;
+		unsigned region = 0;
+
+
+		unsigned bss_size = 0;
+		unsigned data_size = 0;
+
+		// data isn't copied until the final omf segment is built.
+		std::vector<fragment> fragments;
+		std::vector<reloc> relocs;
+		// std::vector<unsigned> symbols;
+
+		unsigned omf_segment = 0;
+		unsigned omf_offset = 0;
+
+
+		unsigned size() const {
+			return type == TYPE_BSS ? bss_size : data_size;
+		}
+
+	};
+
+
+	// an input file or in-memory object.
+	struct input_spec {
+		std::string filename;
+		bool optional = false; // silently skipped if it doesn't exist
+		const uint8_t *data = nullptr; // in memory
+		size_t size = 0;
+	};
+
+	// a parsed and validated elf file, not yet merged into the link.
+	struct input_object {
+		std::string filename;
+		std::string error;
+		bool open_error = false;
+		bool optional = false;
+		bool missing = false;
+		bool stream = false;
+		bool library = false; // named as an input; searched like -l
+
+		int fd = -1;
+		const uint8_t *data = nullptr; // in memory, or mapped by prefetch_file
+		size_t size = 0;
+		std::shared_ptr<uint8_t> map;
+		std::unique_ptr<elf_file> file;
+		std::shared_ptr<void> cached; // set instead of file on a cache hit
+		uint64_t hash = 0; // content hash, if there was a cache miss
+		bool store = false;
+		bool journal = false; // recorded in the incremental link journal
+		uint64_t signature = 0;
+		elf_summary summary;
+
+		std::vector<input_section> sections;
+		std::vector<input_symbol> symbols;
+		std::vector<input_relocs> relocs;
+	};
+
+	// map local elf section to global section
+	struct local_section {
+		int section = 0;
+		int offset = 0;
+	};
+
+	// temporary buffers, reused from file to file for the whole link.
+	struct scratch_buffers {
+		scratch_stats stats;
+
+		scratch_pool<input_section> sections{stats};
+		scratch_pool<input_symbol> symbols{stats};
+		scratch_pool<input_relocs> relocs{stats};
+
+		// merge_file is never run concurrently so these don't need locking.
+		scratch_pool<local_section> local_sections{stats};
+		scratch_pool<int> symbol_to_symbol{stats};
+	};
+
+	// parsed objects which still need to be stored in the cache.
+	struct cache_pending {
+		uint64_t hash = 0;
+		std::vector<input_section> sections;
+		std::vector<input_symbol> symbols;
+		std::vector<input_relocs> relocs;
+	};
+
+	// incremental link (-i): where each of an input's data sections went.
+	struct journal_placement {
+		int section = 0;
+		uint32_t offset = 0;
+		uint32_t size = 0;
+	};
+
+	// bytes at each relocation which the linker might overwrite.
+	static const unsigned fixup_size = 8;
+
+	// container sizes, predicted from the input section headers.
+	struct capacity_plan {
+		unsigned sections = 0;
+		unsigned symbols = 0;
+		unsigned global_symbols = 0;
+		unsigned relocs = 0;
+		std::unordered_map<hashed_name, unsigned, hashed_name_hash> section_relocs;
+	};
+
+	// a fatal error.  Thrown out of the link and reported by link().
+	struct link_error : public std::runtime_error {
+		std::string file;
+
+		link_error(const std::string &message, const std::string &file = "") :
+			std::runtime_error(message), file(file)
+		{}
+	};
+
+	// the output file couldn't be created or written.  Also fatal.
+	struct output_error : public std::system_error {
+		link_diagnostic::output_kind kind;
+
+		output_error(link_diagnostic::output_kind kind, int error, const std::string &message) :
+			std::system_error(error, std::generic_category(), message), kind(kind)
+		{}
+	};
+}
+
+
+static std::string format(const char *fmt, ...) {
+	char buffer[256];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, ap);
+	va_end(ap);
+	return buffer;
+}
+
+
+// everything about one link; link_context's implementation.
+class link_state {
+
+public:
+
+	link_options flags;
+	std::function<void(const link_diagnostic &)> *report = nullptr;
+
+	std::vector<input_spec> inputs;
+	std::vector<std::string> library_paths;
+	std::vector<std::string> directory_paths;
+
+	std::vector<link_diagnostic> diagnostics;
+	std::vector<uint8_t> image;
+	std::string plan;
+	unsigned errors = 0;
+	bool failed = false;
+
+	// resident objects, and the inputs which weren't among them.
+	const resident_map *resident = nullptr;
+	std::atomic<unsigned> resident_hits{0};
+	mutable std::mutex parsed_mutex;
+	std::vector<std::string> parsed;
+
+	explicit link_state(const link_options &options);
+
+	bool link();
+	void update_cache(bool background);
+	void prefetch_file(input_object &obj, bool payload);
+	void parse_file(input_object &obj);
+	void release_buffers(input_object &obj);
+
+private:
+
+	// global symbol and section names, copied once.  The maps' keys point
+	// at the same copy as the symbol or section.
+	string_pool _names;
+
+	flat_name_map _section_map;
+	std::vector<section> _sections;
+
+	flat_name_map _symbol_map;
+	std::vector<symbol> _symbols;
+
+	// input files are kept mapped until the omf file is written.
+	std::vector<std::unique_ptr<elf_file>> _files;
+
+	// libraries and indexed directories, searched once all the input files are loaded.
+	std::vector<std::unique_ptr<archive>> _libraries;
+	std::vector<std::unique_ptr<omf_library>> _omf_libraries;
+	std::vector<std::unique_ptr<symbol_index>> _directories;
+
+	// parsed object cache (-c), the cache entries in use and the parsed
+	// objects which still need to be stored.
+	std::unique_ptr<object_cache> _cache;
+	std::vector<std::shared_ptr<void>> _cache_entries;
+	std::vector<cache_pending> _cache_pending;
+
+	// whole-link key (0 if the link can't be cached) and the input file
+	// hashes computed for it, which parse_file reuses.  The inputs stay
+	// mapped for prefetch_file, since hashing has just read them.
+	uint64_t _link_key = 0;
+	std::unordered_map<std::string, uint64_t> _content_hashes;
+	std::unordered_map<std::string, std::pair<std::shared_ptr<uint8_t>, size_t>> _input_maps;
+	int _hashed = -1;
+
+	// incremental link (-i): the inputs as merged, and where each of their
+	// data sections went.
+	std::vector<link_journal::input> _journal_inputs;
+	std::vector<std::vector<journal_placement>> _journal_placements;
+
+	capacity_plan _plan;
+	scratch_buffers _scratch;
+
+
+	void diagnose(link_diagnostic::kind level, const std::string &message, const std::string &file = "");
+	void diagnose(link_diagnostic &&d);
+	void warning(const std::string &message, const std::string &file = "") {
+		diagnose(link_diagnostic::warning, message, file);
+	}
+	void error(const std::string &message, const std::string &file = "") {
+		diagnose(link_diagnostic::error, message, file);
+	}
+	[[noreturn]] void fail(const std::string &message, const std::string &file = "") {
+		throw link_error(message, file);
+	}
+
+	symbol &find_symbol(std::string_view name);
+	symbol *maybe_find_symbol(std::string_view name);
+	symbol &local_symbol(std::string_view name);
+	section &find_section(std::string_view name);
+	section *maybe_find_section(std::string_view name);
+
+	int abs_reloc(std::vector<uint8_t> &data, uint32_t offset, uint32_t value, unsigned type);
+	void generate_linker_symbols(void);
+	bool check_for_missing_symbols(bool pass1 = true);
+	void to_omf(void);
+	void to_elf(void);
+	int create_output();
+
+	bool resident_lookup(input_object &obj);
+	bool parse_omf(input_object &obj, int &fd);
+	int merge_file(input_object &obj);
+	void plan_capacity(const std::vector<input_object> &objects);
+	void process_files(std::vector<input_object> &objects);
+	void load_files(const std::vector<input_spec> &inputs);
+	void open_library(const std::string &path);
+	void open_directory(const std::string &dir);
+	void search_libraries(void);
+	int one_file(const std::string &filename);
+	void init(void);
+
+	bool hash_inputs(const std::vector<input_spec> &inputs, const std::vector<std::string> &libraries);
+	std::string option_string(void);
+	uint64_t link_key(const std::vector<input_spec> &inputs, const std::vector<std::string> &libraries);
+	void write_journal(const std::vector<omf::segment> &segments);
+	bool incremental_link(const std::vector<input_spec> &inputs, const std::vector<std::string> &libraries);
+};
+
+
+unsigned name_to_region(std::string_view name) {
+	static std::unordered_map<std::string_view, unsigned> map = {
+		{"registers", REGION_DP},
+		{"tiny", REGION_DP},
+		{"ztiny", REGION_DP},
+		{"stack", REGION_DP},
+
+		{"data", REGION_NEAR},
+		{"cdata", REGION_NEAR},
+		{"zdata", REGION_NEAR},
+
+		{"near", REGION_NEAR},
+		{"cnear", REGION_NEAR},
+		{"znear", REGION_NEAR},
+
+		{"far", REGION_FAR},
+		{"cfar", REGION_FAR},
+		{"zfar", REGION_FAR},
+
+		{"huge", REGION_FAR},
+		{"chuge", REGION_FAR},
+		{"zhuge", REGION_FAR},
+	};
+
+
+	auto iter = map.find(name);
+	return (iter == map.end()) ? 0 : iter->second; 
+}
+
+unsigned type_to_type(unsigned sh_type, unsigned sh_flags) {
+	if (sh_type == SHT_NOBITS) return TYPE_BSS;
+
+	if (sh_type == SHT_PROGBITS) {
+		if (sh_flags & SHF_EXECINSTR) return TYPE_CODE;
+		if (sh_flags & SHF_WRITE) return TYPE_DATA;
+		return TYPE_CDATA;
+	}
+	// should not happen...
+	return 0;
+}
+
+/* find or create a symbol */
+symbol &link_state::find_symbol(std::string_view name) {
+	hashed_name key(name);
+	int *id = _symbol_map.find(key);
+	if (!id) {
+		auto &sym = _symbols.emplace_back();
+		sym.name = key.name = _names.copy(name);
+		sym.id = _symbols.size();
+
+		_symbol_map.emplace(key, sym.id);
+		return sym;
+	}
+	return _symbols[*id - 1];
+}
+
+symbol *link_state::maybe_find_symbol(std::string_view name) {
+	int *id = _symbol_map.find(hashed_name(name));
+	return id ? &_symbols[*id - 1] : nullptr;
+}
+
+
+#if 0
+symbol &link_state::find_symbol(const std::string &name, bool anonymous) {
+
+	auto iter = _symbol_map.find(name);
+	if (iter == _symbol_map.end()) {
+		auto &sym = _symbols.emplace_back();
+		sym.name = name;
+		sym.id = _symbols.size();
+
+		if (!anonymous) _symbol_map.emplace(name, sym.id);
+		return sym;
+	}
+	return _symbols[iter->second - 1];
+}
+#endif
+
+// create a local symbol.  Locals are only referenced by their symbol
+// table index so they aren't in the map, and several may share a name
+// (eg, static functions in an object from -r).  The name isn't copied;
+// it stays in the input, which is kept until the link is done.
+symbol &link_state::local_symbol(std::string_view name) {
+	auto &sym = _symbols.emplace_back();
+	sym.name = name;
+	sym.id = _symbols.size();
+	sym.local = true;
+	return sym;
+}
+
+
+
+/* find or create a section */
+section &link_state::find_section(std::string_view name) {
+
+	/* special case for known dp segments! */
+
+	hashed_name key(name);
+	int *id = _section_map.find(key);
+	if (!id) {
+		auto &s = _sections.emplace_back();
+		s.name = key.name = _names.copy(name);
+		s.id = _sections.size();
+
+
+		s.region = name_to_region(name);
+
+		auto p = _plan.section_relocs.find(key);
+		if (p != _plan.section_relocs.end()) s.relocs.reserve(p->second);
+
+		_section_map.emplace(key, s.id);
+		return s;
+	}
+	return _sections[*id - 1];
+}
+
+section *link_state::maybe_find_section(std::string_view name) {
+	int *id = _section_map.find(hashed_name(name));
+	return id ? &_sections[*id - 1] : nullptr;
+}
+
+
+
+
+// 16 and 17 aren't elf relocation types.  They're the high and bank byte
+// of an address, which only omf objects produce.
+static unsigned type_to_size[18] = { 0, 1, 2, 3, 4, 8, 0, 0, 1, 2, 2, 1, 2, 3, 2, 2, 1, 1 };
+static unsigned type_to_shift[18] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 16, 0, 16, 8, 16 };
+
+int link_state::abs_reloc(std::vector<uint8_t> &data, uint32_t offset, uint32_t value, unsigned type) {
+
+	if (type > 17) return -1;
+	unsigned size = type_to_size[type];
+	unsigned shift = type_to_shift[type];
+
+	if (offset >= data.size()) return -1;
+	if (offset + size > data.size()) return -1;
+
+	switch (type) {
+	case 0:
+	case 6:
+	case 7:
+		/* unknown type */
+		return -1;
+	case 1: /* dp */
+	case 8:
+		if (value > 0xff) warning(".tiny absolute relocation overflow");
+		break;
+	case 2: /* abs */
+	case 9:
+		if (value > 0xffff) warning(".near absolute relocation overflow");
+		break;
+	case 3: /* long */
+		if (value > 0xffffff) warning(".far absolute relocation overflow");
+		break;
+	case 10: /* .kbank */
+		if (value > 0xffff) warning(".kbank absolute relocation overflow");
+		break;
+	}
+
+	if (shift) value >>= shift;
+	for (unsigned i = 0; i < size; ++i, ++offset, value >>= 8) {
+		data[offset] = value & 0xff;
+	}
+
+	return 0;
+}
+
+// .section attributes:
+// rodata -> SHT_PROGBITS, SHF_ALLOC
+// text   -> SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR
+// data   -> SHT_PROGBITS, SHF_ALLOC | SHF_WRITE
+// bss    -> SHT_NOBITS,   SHF_ALLOC | SHF_WRITE
+
+
+// linker generated symbols:
+// _O\x03.sectionStart_[name]
+// _O\x03.sectionEnd_[name]
+// _O\x03.sectionSize_[name] (32-bit absolute)
+// _DirectPageStart
+ 
+/*
+ * standard segments
+ * dp:
+ *   registers, tiny, ztiny
+ * code:
+ *   code, compactcode,farcode,
+ * data:
+ *   data, cdata (ro) zdata (bss)
+ *   near, cnear (ro), znear (bss)
+ *   far , cfar (ro), zfar (bss)
+ *   huge, chuge, (ro) zhuge (bss)
+ *
+ * calypsi linker-generated:
+ *   itiny, idata, inear, ifar, ihuge, data_init_table
+ * other:
+ *   reset, stack, heap
+ *
+ */
+
+
+
+// if there is a stack segment, it will be adjusted later
+void link_state::generate_linker_symbols(void) {
+	// .sectionStart, .sectionEnd, .sectionSize.
+	for (auto &s : _sections) {
+
+		std::string name;
+		symbol *sym;
+
+		name = "_O\x03.sectionStart_";
+		name += s.name;
+		if ((sym = maybe_find_symbol(name))) {
+			sym->section = s.id;
+			sym->offset = 0;
+		}
+
+		name = "_O\x03.sectionEnd_";
+		name += s.name;
+		if ((sym = maybe_find_symbol(name))) {
+			sym->section = s.id;
+			sym->offset = s.data_size - 1;
+		}
+
+		name = "_O\x03.sectionSize_";
+		name += s.name;
+		if ((sym = maybe_find_symbol(name))) {
+			sym->section = -1;
+			sym->offset = s.data_size;
+			sym->absolute = true;
+		}
+	}
+}
+
+
+bool link_state::check_for_missing_symbols(bool pass1) {
+
+	// linker-generated symbols.
+	static std::unordered_set<std::string_view> skippable = {
+		"_DirectPageStart", "_NearBaseAddress",
+		"_O\x03.sectionStart_stack",
+		"_O\x03.sectionEnd_stack",
+		"_O\x03.sectionSize_stack",
+	};
+
+	bool ok = true;
+	for (auto &sym : _symbols) {
+
+		if (!sym.count) continue;
+		if (sym.absolute) continue;
+		if (sym.section == 0) {
+			if (pass1 && skippable.count(sym.name)) continue;
+			error("undefined symbol: " + std::string(sym.name));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+
+template<class T>
+void move_or_append(std::vector<T> &out, std::vector<T> &in) {
+
+	if (out.empty()) {
+		out = std::move(in);
+	} else {
+		out.insert(out.end(), in.begin(), in.end());
+	}
+}
+
+
+template<class T>
+void append(std::vector<T> &out, const std::vector<T> &in) {
+
+	out.insert(out.end(), in.begin(), in.end());
+}
+
+// copy a section's data onto the end of an omf segment.
+void copy_section(std::vector<uint8_t> &out, const section &s) {
+
+	size_t base = out.size();
+	for (const auto &f : s.fragments) {
+		out.resize(base + f.offset); // alignment padding
+		out.insert(out.end(), f.data.begin(), f.data.end());
+	}
+	out.resize(base + s.data_size);
+}
+
+typedef std::vector<std::reference_wrapper<section>> section_ref_vector ;
+
+// counts up region sizes.
+unsigned analyze(const section_ref_vector &sections, unsigned data[5][7]) {
+
+	unsigned total = 0;
+	for (const section &s : sections) {
+
+		unsigned sz = data[s.region][s.type];
+		unsigned x = s.size();
+
+		unsigned mask = 0;
+		if (s.align > 1) {
+			mask = s.align - 1;
+			sz = (sz + mask) & ~mask;
+			total = (total + mask) & ~mask;
+		}
+
+		data[s.region][s.type] = sz + x;
+		total += x;
+
+		// total this region excl code [?]
+		if (s.type != TYPE_CODE) {
+			sz = data[s.region][5];
+			if (mask) sz = (sz + mask) & ~mask;
+			data[s.region][5] = sz + x;
+		}
+
+		// total this region
+		sz = data[s.region][6];
+		if (mask) sz = (sz + mask) & ~mask;
+		data[s.region][6] = sz + x;
+	}
+	return total;
+}
+
+
+static void json_string(std::string &out, std::string_view s) {
+	out.push_back('"');
+	for (unsigned char c : s) {
+		if (c == '"' || c == '\\') {
+			out.push_back('\\');
+			out.push_back(c);
+		} else if (c < 0x20 || c >= 0x7f) {
+			out += format("\\u%04x", c);
+		} else {
+			out.push_back(c);
+		}
+	}
+	out.push_back('"');
+}
+
+// the layout plan (-n).  sections are in layout order; any which weren't
+// placed (too big for one segment) are listed as sizes only.
+static std::string layout_json(const std::vector<omf::segment> &segments, const section_ref_vector &sections, unsigned total) {
+
+	static const char *types[] = { "", "code", "data", "cdata", "bss" };
+	static const char *regions[] = { "", "dp", "near", "far", "huge" }; // 0 is unspecified
+
+	std::string out;
+	out += "{\n";
+	out += format("\t\"fits\": %s,\n", total < 0x010000 ? "true" : "false");
+	out += format("\t\"size\": %u,\n", total);
+	out += "\t\"segments\": [";
+
+	for (size_t i = 0; i < segments.size(); ++i) {
+		const auto &seg = segments[i];
+		out += i ? ",\n" : "\n";
+		out += format("\t\t{\n\t\t\t\"segnum\": %u,\n\t\t\t\"name\": ", seg.segnum);
+		json_string(out, seg.segname);
+		out += format(",\n\t\t\t\"kind\": %u,\n", seg.kind);
+		out += format("\t\t\t\"length\": %u,\n", (unsigned)(seg.data.size() + seg.reserved_space));
+		out += format("\t\t\t\"reserved\": %u,\n", seg.reserved_space);
+		out += format("\t\t\t\"alignment\": %u,\n", seg.alignment);
+		out += "\t\t\t\"sections\": [";
+
+		bool first = true;
+		for (const section &s : sections) {
+			if (s.omf_segment != seg.segnum) continue;
+			out += first ? "\n" : ",\n";
+			first = false;
+			out += "\t\t\t\t{ \"name\": ";
+			json_string(out, s.name);
+			out += format(", \"type\": \"%s\"", types[s.type]);
+			if (s.region) out += format(", \"region\": \"%s\"", regions[s.region]);
+			out += format(", \"offset\": %u, \"size\": %u, \"align\": %u }", s.omf_offset, s.size(), s.align);
+		}
+		out += first ? "]\n" : "\n\t\t\t]\n";
+		out += "\t\t}";
+	}
+	out += segments.empty() ? "],\n" : "\n\t],\n";
+
+	out += "\t\"unplaced\": [";
+	bool first = true;
+	for (const section &s : sections) {
+		if (s.omf_segment) continue;
+		out += first ? "\n" : ",\n";
+		first = false;
+		out += "\t\t{ \"name\": ";
+		json_string(out, s.name);
+		out += format(", \"type\": \"%s\"", types[s.type]);
+		if (s.region) out += format(", \"region\": \"%s\"", regions[s.region]);
+		out += format(", \"size\": %u, \"align\": %u }", s.size(), s.align);
+	}
+	out += first ? "]\n" : "\n\t]\n";
+	out += "}\n";
+	return out;
+}
+
+
+void write_journal(const std::vector<omf::segment> &segments);
+
+void link_state::to_omf(void) {
+
+
+	section *stack = nullptr;
+	// make sure there's a stack segment if needed.
+	{
+		auto s = maybe_find_section("stack");
+		if (s) {
+			stack = s;
+			if (s->type != TYPE_BSS) fail("stack section not bss");
+			s->bss_size = (s->bss_size + 0xff) & ~0xff;
+			s->align = 0;
+			if (flags.stack && flags.stack != s->size()) {
+				warning("-S ignored");
+			}
+		} else if (flags.stack) {
+			auto &s = find_section("stack");
+			s.type = TYPE_BSS;
+			s.bss_size = flags.stack;
+			stack = &s;
+		}
+	}
+
+
+	section_ref_vector sections;
+	section_ref_vector dp_sections;
+
+	sections.reserve(_sections.size());
+	dp_sections.reserve(4);
+
+	for (auto &s : _sections) {
+		if (s.type == TYPE_BSS) continue;
+
+		if (s.region == REGION_DP) {
+			dp_sections.push_back(std::ref(s));
+		} else {
+			sections.push_back(std::ref(s));
+		}
+	}
+	// bss last
+	for (auto &s : _sections) {
+		if (s.type != TYPE_BSS) continue;
+
+		if (s.region == REGION_DP) {
+			if (&s == stack) continue; // special handling... 
+			dp_sections.push_back(std::ref(s));
+		} else {
+			sections.push_back(std::ref(s));
+		}
+	}
+
+	// sort the dp sections - registers, tiny, ztiny, stack
+	// n.b. - aside from stack, these are alphabetical. so just compare the first letter.
+	std::sort(dp_sections.begin(), dp_sections.end(), [](const section &a, const section &b){
+		unsigned ca = a.name.front();
+		unsigned cb = b.name.front();
+		if (ca == 's') ca = 'z'+1;
+		if (cb == 's') cb = 'z'+1;
+		return ca < cb;
+	});
+
+
+	unsigned sizes[5][7] = {};
+
+	unsigned total = analyze(sections, sizes);
+	analyze(dp_sections, sizes);
+	// best case -- 1 segment!
+
+	// link types
+	// 1. everything goes in 1 segment
+	// 2. all near segments merged
+	// 3. all near data merged, separate near code
+	// 4. 
+
+
+	std::vector<omf::segment> segments;
+	unsigned segnum = 1;
+	if (total < 0x010000) {
+		auto &seg = segments.emplace_back();
+		seg.segnum = segnum++;
+		seg.data.reserve(total);
+
+
+		unsigned offset = 0;
+		bool need_align = false;
+		for (section &s : sections) {
+
+			unsigned mask = 0;
+			unsigned sz = s.size();
+			if (s.align > 1) {
+				need_align = true;
+				mask = s.align - 1;
+			}
+
+
+
+			if (s.type == TYPE_BSS) {
+
+				if (mask) {
+					unsigned orig = offset;
+					offset = (offset + mask) & ~mask;
+					seg.reserved_space += (offset - orig);
+				}
+				seg.reserved_space += sz;
+			} else {
+
+				if (mask) {
+					offset = (offset + mask) & ~mask;
+					seg.data.resize(offset);
+				}
+
+				// a plan (-n) only needs the size.
+				if (flags.n) seg.data.resize(offset + sz);
+				else copy_section(seg.data, s);
+			}
+
+			s.omf_segment = seg.segnum;
+			s.omf_offset = offset;
+			offset += sz;
+		}
+		// omf only has page or bank alignment.
+		if (need_align) seg.alignment = 0x0100;
+
+
+		//
+		symbol *sym;
+		if ((sym = maybe_find_symbol("_NearBaseAddress"))) {
+			const section &s = sections.front(); 
+			sym->section = s.id;
+			sym->offset = 0;
+		}
+
+	} else {
+		if (flags.n) plan = layout_json(segments, sections, total);
+		fail(format("too big for one segment ($%06x); multiple segments not yet supported", total));
+	}
+
+	// now handle the dp segment.
+	unsigned dp_size = analyze(dp_sections, sizes);
+
+	// could also check if we need an explicit direct page --
+	// via symbols (.sectionStart stack, _DirectPageStart)
+
+	if (dp_size > 0 || stack) {
+
+		if (dp_size > 0xff) {
+			fail(format("dp exceeds 1 page ($%04x)", dp_size));
+		}
+
+		if (dp_size > 0 && !stack) {
+			fail("stack section missing.  Use -S size or create a bss stack section.");
+		}
+
+		if (stack && stack->size() > 0x8000) {
+			fail(format("stack too big ($%04x)", stack->size()));
+		}
+
+		int stack_size = stack ? stack->size() - dp_size : 0;
+		if (stack && stack_size <= 0)
+			fail(format("stack too small ($%04x)", stack_size));
+
+		auto &seg = segments.emplace_back();
+		seg.segnum = segnum++;
+		seg.kind = 0x12; // dp/stack
+		seg.segname = "dp/stack";
+		seg.data.reserve(dp_size);
+
+		if (stack) {
+			stack->align = 0; // no alignment
+			stack->bss_size = stack_size;
+			dp_sections.emplace_back(std::ref(*stack));
+
+			symbol *sym;
+			// update symbols (only size and end shoud be changing)
+
+			if ((sym = maybe_find_symbol("_O\x03.sectionStart_stack"))) {
+				sym->section = stack->id;
+				sym->offset = 0;
+			}
+			if ((sym = maybe_find_symbol("_O\x03.sectionEnd_stack"))) {
+				sym->section = stack->id;
+				sym->offset = stack_size - 1;
+			}
+			if ((sym = maybe_find_symbol("_O\x03.sectionSize_stack"))) {
+				sym->section = -1;
+				sym->offset = stack_size;
+				sym->absolute = true;
+			}
+		}
+
+		if (!dp_sections.empty()) {
+			symbol *sym;
+			section &s = dp_sections.front();
+			if ((sym = maybe_find_symbol("_DirectPageStart"))) {
+				sym->section = s.id;
+				sym->offset = 0;
+			}
+		}
+
+
+		unsigned offset = 0;
+		for (section &s : dp_sections) {
+
+			unsigned mask = 0;
+			unsigned sz = s.size();
+			if (s.align > 1) {
+				mask = s.align - 1;
+			}
+
+			if (s.type == TYPE_BSS) {
+
+				if (mask) {
+					unsigned orig = offset;
+					offset = (offset + mask) & ~mask;
+					seg.reserved_space += (offset - orig);
+				}
+				seg.reserved_space += sz;
+			} else {
+
+				if (mask) {
+					offset = (offset + mask) & ~mask;
+					seg.data.resize(offset);
+				}
+				if (flags.n) seg.data.resize(offset + sz);
+				else copy_section(seg.data, s);
+			}
+
+			s.omf_segment = seg.segnum;
+			s.omf_offset = offset;
+			offset += sz;
+		}
+
+	}
+
+	// ok, now we can convert dp relocations into absolute values.
+	// ... and convert relocations to omf relocations.
+
+
+	append(sections, dp_sections);
+
+	if (flags.n) {
+		plan = layout_json(segments, sections, total);
+		return;
+	}
+
+	for (const section &s : sections) {
+
+		auto &seg = segments[s.omf_segment - 1];
+
+		for (const auto &r : s.relocs) {
+
+			const auto &sym = _symbols[r.symbol - 1];
+
+			unsigned offset = r.offset + s.omf_offset;
+			unsigned value = r.value + sym.offset;
+
+			if (sym.absolute) {
+				abs_reloc(seg.data, offset, value, r.type);
+				continue;
+			}
+
+			if (!r.symbol) fail("relocation missing symbol");
+
+			const auto &src = _sections[sym.section - 1];
+
+			value += src.omf_offset;
+
+			// convert dp reference to a constant.
+			if (r.type == 1 || r.type == 8 || r.type == 11) {
+				abs_reloc(seg.data, offset, value, r.type);
+				continue;
+			}
+
+			unsigned size = type_to_size[r.type];
+			unsigned shift = -type_to_shift[r.type];
+
+			if (src.omf_segment == s.omf_segment) {
+				omf::reloc rr;
+				rr.size = size;
+				rr.shift = shift;
+				rr.offset = offset;
+				rr.value = value;
+				seg.relocs.push_back(rr);
+			} else {
+				omf::interseg is;
+				is.size = size;
+				is.shift = shift;
+				is.offset = offset;
+				is.segment = src.omf_segment;
+				is.segment_offset = value;
+				seg.intersegs.push_back(is);
+			}
+
+		}
+
+	}
+
+
+	if (flags.o.empty()) {
+		image = omf_image(segments, flags.omf_flags, flags.jobs);
+		return;
+	}
+	int fd = create_output();
+	try {
+		save_omf(fd, segments, flags.omf_flags, flags.jobs);
+	} catch (std::system_error &ex) {
+		close(fd);
+		throw output_error(link_diagnostic::output_write, ex.code().value(), "write " + flags.o);
+	}
+	close(fd);
+	if (flags.i) write_journal(segments);
+}
+
+
+// partial link (-r): write the merged sections, symbols and relocations as
+// one elf object.  Relocations against local symbols which aren't written
+// (unnamed or, with -x, stripped) use the section symbol instead.
+void link_state::to_elf(void) {
+
+	if (flags.stack) warning("-S ignored");
+
+	std::vector<elf::section> sections(_sections.size());
+	for (size_t i = 0; i < _sections.size(); ++i) {
+		const auto &s = _sections[i];
+		auto &es = sections[i];
+
+		es.name = s.name;
+		es.align = s.align;
+		switch (s.type) {
+			case TYPE_CODE: es.flags = SHF_ALLOC | SHF_EXECINSTR; break;
+			case TYPE_DATA: es.flags = SHF_ALLOC | SHF_WRITE; break;
+			case TYPE_CDATA: es.flags = SHF_ALLOC; break;
+			case TYPE_BSS:
+				es.type = SHT_NOBITS;
+				es.flags = SHF_ALLOC | SHF_WRITE;
+				es.size = s.bss_size;
+				break;
+		}
+		if (s.type != TYPE_BSS) copy_section(es.data, s);
+	}
+
+	// section symbols, locals, then globals.
+	std::vector<elf::symbol> symbols;
+	std::vector<unsigned> symbol_index(_symbols.size() + 1); // 0 = not written
+	symbols.reserve(_sections.size() + _symbols.size());
+
+	for (size_t i = 0; i < _sections.size(); ++i) {
+		auto &es = symbols.emplace_back();
+		es.bind = STB_LOCAL;
+		es.type = STT_SECTION;
+		es.shndx = i + 1;
+	}
+
+	for (int pass = 0; pass < 2; ++pass) {
+		for (const auto &sym : _symbols) {
+			if (sym.local != (pass == 0)) continue;
+
+			if (sym.local) {
+				if (sym.name.empty()) continue;
+				// absolute symbols have no section symbol to stand in for them.
+				if (flags.x && !(sym.absolute && sym.count)) continue;
+			} else {
+				if (!sym.section && !sym.count) continue;
+			}
+
+			auto &es = symbols.emplace_back();
+			es.name = sym.name;
+			es.bind = sym.local ? STB_LOCAL : sym.weak ? STB_WEAK : STB_GLOBAL;
+			if (sym.absolute) es.shndx = SHN_ABS;
+			else if (sym.section > 0) es.shndx = sym.section;
+			es.value = sym.offset;
+			symbol_index[sym.id] = symbols.size();
+		}
+	}
+
+	for (size_t i = 0; i < _sections.size(); ++i) {
+		const auto &s = _sections[i];
+		auto &es = sections[i];
+
+		es.relocs.reserve(s.relocs.size());
+		for (const auto &r : s.relocs) {
+			const auto &sym = _symbols[r.symbol - 1];
+
+			unsigned index = symbol_index[sym.id];
+			uint32_t addend = r.value;
+			if (!index) {
+				index = sym.section;
+				addend += sym.offset;
+			}
+
+			es.relocs.push_back(Elf32_Rela{ r.offset, ELF32_R_INFO(index, r.type), (Elf32_Sword)addend });
+		}
+	}
+
+	if (flags.o.empty()) {
+		image = elf_image(sections, symbols);
+		return;
+	}
+	int fd = create_output();
+	try {
+		save_elf(fd, sections, symbols);
+	} catch (std::system_error &ex) {
+		close(fd);
+		throw output_error(link_diagnostic::output_write, ex.code().value(), "write " + flags.o);
+	}
+	close(fd);
+}
+
+int link_state::create_output() {
+	int fd = open(flags.o.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	if (fd < 0) throw output_error(link_diagnostic::output_create, errno, "Unable to open " + flags.o);
+	return fd;
+}
+
+
+// open and map a file and start reading it in the background.
+void link_state::prefetch_file(input_object &obj, bool payload) {
+
+	if (obj.data) return;
+
+	if (obj.filename == "-") {
+		obj.fd = dup(STDIN_FILENO);
+		obj.stream = true;
+		return;
+	}
+
+	// hash_inputs has already mapped (and read) it.
+	auto iter = _input_maps.find(obj.filename);
+	if (iter != _input_maps.end() && !resident) {
+		obj.map = iter->second.first;
+		obj.size = iter->second.second;
+		obj.data = obj.map.get();
+		prefetch_elf(obj.data, obj.size, &obj.summary, false);
+		return;
+	}
+
+	obj.fd = open(obj.filename.c_str(), O_RDONLY);
+	if (obj.fd < 0) {
+		obj.missing = errno == ENOENT;
+		obj.error = strerror(errno);
+		obj.open_error = true;
+		return;
+	}
+
+	// resident objects are looked up by name and usually aren't read at
+	// all, so those are only checked for streams.
+	if (!resident) obj.map = object_cache::map(obj.fd, obj.size);
+	if (obj.map) {
+		obj.data = obj.map.get();
+		prefetch_elf(obj.data, obj.size, &obj.summary, payload);
+	} else {
+		struct stat st;
+		if (fstat(obj.fd, &st) == 0 && !S_ISREG(st.st_mode)) {
+			obj.stream = true;
+			return;
+		}
+	}
+
+	// the mapping (and readahead) outlives the descriptor, which keeps the
+	// number of open files down on very large links.
+	close(obj.fd);
+	obj.fd = -1;
+}
+
+// read every object from a pipe, stdin, or other stream.  These can only
+// be read sequentially so this happens before the parallel parse.
+void read_stream(input_object &obj, std::vector<input_object> &out) {
+
+	std::string name = obj.filename == "-" ? "stdin" : obj.filename;
+	size_t first = out.size();
+
+	for(;;) {
+		auto &tmp = out.emplace_back();
+		tmp.filename = name;
+		try {
+			tmp.file = elf_file::read_stream(obj.fd);
+			if (!tmp.file) {
+				out.pop_back();
+				break;
+			}
+		} catch(std::exception &ex) {
+			tmp.error = ex.what();
+			break;
+		}
+	}
+
+	close(obj.fd);
+	obj.fd = -1;
+
+	if (out.size() == first) {
+		auto &tmp = out.emplace_back();
+		tmp.filename = name;
+		tmp.error = "no elf objects";
+		return;
+	}
+	// name them by position if the stream had several objects.
+	if (out.size() - first > 1) {
+		for (size_t i = first; i < out.size(); ++i) {
+			out[i].filename = name + "(" + std::to_string(i - first + 1) + ")";
+		}
+	}
+}
+
+
+// return a merged (or failed) input object's buffers to the pool.
+void link_state::release_buffers(input_object &obj) {
+	_scratch.relocs.release(obj.relocs);
+	_scratch.symbols.release(obj.symbols);
+	_scratch.sections.release(obj.sections);
+}
+
+
+// everything about a parsed object except its section contents.  If two
+// versions of an object have the same signature they produce the same
+// layout and relocations, and the output only differs in their section
+// data.  The bytes under each relocation are included since the linker
+// may or may not overwrite them.
+uint64_t object_signature(const input_object &obj) {
+
+	std::string buffer;
+	auto put = [&](uint32_t x) { buffer.append((const char *)&x, sizeof(x)); };
+	auto put_string = [&](std::string_view x) { put(x.size()); buffer.append(x); };
+
+	put(obj.sections.size());
+	for (const auto &s : obj.sections) {
+		put_string(s.name);
+		put(s.type);
+		put(s.align);
+		put(s.size);
+		put(s.type ? s.data.size() : 0);
+	}
+
+	put(obj.symbols.size());
+	for (const auto &x : obj.symbols) {
+		put(x.named);
+		put_string(x.name);
+		put(x.bind);
+		put(x.shndx);
+		put(x.value);
+	}
+
+	for (const auto &ir : obj.relocs) {
+		const auto &data = obj.sections[ir.section].data;
+		put(ir.section);
+		put(ir.relocs.size());
+		for (size_t i = 0; i < ir.relocs.size(); ++i) {
+			const Elf32_Rela r = ir.relocs[i];
+			put(r.r_offset);
+			put(r.r_info);
+			put(r.r_addend);
+			for (uint64_t j = r.r_offset; j < (uint64_t)r.r_offset + fixup_size; ++j)
+				buffer.push_back(j < data.size() ? data[j] : 0);
+		}
+	}
+
+	return object_cache::hash((const uint8_t *)buffer.data(), buffer.size());
+}
+
+// use the resident copy of an unchanged object.
+bool link_state::resident_lookup(input_object &obj) {
+
+	std::string path = absolute_path(obj.filename);
+
+	struct stat st;
+	auto iter = resident->find(path);
+	if (iter != resident->end() && stat(path.c_str(), &st) == 0
+		&& symbol_index::make_stamp(st) == iter->second.stamp) {
+
+		const auto &ro = iter->second;
+		obj.sections = _scratch.sections.acquire(ro.sections.size());
+		obj.sections.assign(ro.sections.begin(), ro.sections.end());
+		obj.symbols = _scratch.symbols.acquire(ro.symbols.size());
+		obj.symbols.assign(ro.symbols.begin(), ro.symbols.end());
+		obj.relocs = _scratch.relocs.acquire(ro.relocs.size());
+		obj.relocs.assign(ro.relocs.begin(), ro.relocs.end());
+		obj.cached = ro.file;
+		if (flags.i) obj.signature = object_signature(obj);
+		++resident_hits;
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(parsed_mutex);
+	parsed.emplace_back(std::move(path));
+	return false;
+}
+
+// OMF objects and libraries are recognised by their contents and decoded
+// into the same sections, symbols and relocations as an elf file.  Returns
+// false if obj isn't one.  Archives named as inputs are recognised here
+// too, since they're also searched like -l.
+bool link_state::parse_omf(input_object &obj, int &fd) {
+
+	const uint8_t *data = obj.data;
+	size_t size = obj.size;
+	std::shared_ptr<uint8_t> map = obj.map;
+
+	if (!data) {
+		uint8_t magic[SELFMAG];
+		if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && !memcmp(magic, ELFMAG, SELFMAG))
+			return false;
+		map = object_cache::map(fd, size);
+		if (!map) return false;
+		data = map.get();
+	}
+	bool library = archive::is_archive(data, size);
+	if (!library && !is_omf(data, size)) return false;
+
+	if (fd >= 0) close(fd);
+	fd = -1;
+
+	// opened and searched once the inputs are loaded.
+	if (library || is_omf_library(data, size)) {
+		if (!map) throw std::runtime_error("library in memory");
+		obj.library = true;
+		return true;
+	}
+
+	auto omf = read_omf_object(data, size);
+	obj.sections = _scratch.sections.acquire(omf->sections.size());
+	obj.sections.assign(omf->sections.begin(), omf->sections.end());
+	obj.symbols = _scratch.symbols.acquire(omf->symbols.size());
+	obj.symbols.assign(omf->symbols.begin(), omf->symbols.end());
+	obj.relocs = _scratch.relocs.acquire(omf->relocs.size());
+	obj.relocs.assign(omf->relocs.begin(), omf->relocs.end());
+	obj.cached = std::move(omf);
+	if (flags.i) obj.signature = object_signature(obj);
+	return true;
+}
+
+// parse one elf file.  This only reads the link state so it's safe to run
+// on a worker thread.
+void link_state::parse_file(input_object &obj) {
+
+	// 1. open, verify it's a 65816 elf file
+	// 2. decode sections, symbols, and relocation records.
+
+	// (files from an indexed directory are already open.)
+	if (resident && !obj.file && !obj.data && obj.fd < 0 && obj.error.empty()
+		&& resident_lookup(obj)) return;
+
+	if (!obj.file && !obj.data && obj.fd < 0 && !obj.open_error && obj.error.empty()) {
+		obj.fd = open(obj.filename.c_str(), O_RDONLY);
+		if (obj.fd < 0) {
+			obj.missing = errno == ENOENT;
+			obj.error = strerror(errno);
+			obj.open_error = true;
+		}
+	}
+	if (!obj.error.empty()) return;
+
+	int fd = obj.fd;
+	obj.fd = -1;
+
+	try {
+		if (!obj.file && parse_omf(obj, fd)) return;
+
+		if (!obj.file && !obj.data && _cache) {
+			obj.map = object_cache::map(fd, obj.size);
+			obj.data = obj.map.get();
+		}
+
+		if (!obj.file && obj.map && _cache) {
+			// hash the contents; on a hit the elf file isn't needed at all.
+			auto iter = _content_hashes.find(obj.filename);
+			uint64_t hash = iter != _content_hashes.end()
+				? iter->second : object_cache::hash(obj.data, obj.size);
+
+			obj.sections = _scratch.sections.acquire(0);
+			obj.symbols = _scratch.symbols.acquire(0);
+			obj.relocs = _scratch.relocs.acquire(0);
+			obj.cached = _cache->load(hash, obj.sections, obj.symbols, obj.relocs);
+			if (obj.cached) {
+				++_cache->hits;
+				if (fd >= 0) close(fd);
+				obj.map.reset();
+				obj.data = nullptr;
+				return;
+			}
+			++_cache->misses;
+			obj.sections.clear();
+			obj.symbols.clear();
+			obj.relocs.clear();
+			obj.hash = hash;
+			obj.store = true;
+		}
+
+		if (!obj.file && obj.data) {
+			obj.file.reset(new elf_file(obj.data, obj.size, obj.map));
+			if (fd >= 0) close(fd);
+			fd = -1;
+		}
+
+		if (!obj.file) {
+			obj.file.reset(new elf_file(fd));
+			close(fd);
+			fd = -1;
+		}
+
+		const auto &file = *obj.file;
+		const auto &header = file.header();
+
+		// verify elf file info
+		bool ok = true;
+		if (header.e_ident[EI_CLASS] != ELFCLASS32) ok = false;
+		if (header.e_ident[EI_VERSION] != EV_CURRENT) ok = false;
+		if (header.e_type != ET_REL) ok = false;
+		if (header.e_machine != EM_65816) ok = false;
+		if (header.e_version != EV_CURRENT) ok = false;
+		if (header.e_shentsize != sizeof(Elf32_Shdr)) ok = false;
+		if (header.e_shnum == 0) ok = false;
+
+		if (!ok) {
+			throw_elf_error("Not a 65816 elf file");
+		}
+
+
+		auto sections = file.sections();
+		auto string_table = file.strings(sections.at(header.e_shstrndx));
+
+		obj.sections = _scratch.sections.acquire(header.e_shnum);
+		obj.sections.resize(header.e_shnum);
+
+		// pass 1 - process SHT_PROGBITS and SHT_NOBITS
+		// also load the symbol table.
+		// i suppose there could be > 1 symbol table but only one supported for now.
+		int current_st = -1;
+		view<Elf32_Sym> st;
+
+		int sh_num = -1;
+		for (const auto &s : sections) {
+
+			++sh_num;
+			if (s.sh_type == SHT_SYMTAB) {
+				if (current_st != -1) throw_elf_error("multiple symbol tables");
+				current_st = sh_num;
+				st = file.table<Elf32_Sym>(s);
+				continue;
+			}
+
+			if (s.sh_type != SHT_NOBITS && s.sh_type != SHT_PROGBITS) continue;
+
+			auto &is = obj.sections[sh_num];
+			is.name = string_table[s.sh_name];
+			is.type = type_to_type(s.sh_type, s.sh_flags);
+			is.align = s.sh_addralign;
+			is.size = s.sh_size;
+			is.data = file.data(s);
+		}
+
+
+		// pass 1.5 -- decode the symbol table.
+		obj.symbols = _scratch.symbols.acquire(st.size());
+		obj.symbols.resize(st.size());
+		for (size_t i = 0; i < st.size(); ++i) {
+			const auto &x = st[i];
+			auto &sym = obj.symbols[i];
+
+			// unnamed symbols are kept for section symbols (STT_SECTION),
+			// which relocations can refer to.
+			if (string_table.valid(x.st_name)) {
+				sym.name = string_table[x.st_name];
+				sym.named = true;
+			}
+			sym.bind = ELF32_ST_BIND(x.st_info);
+			sym.shndx = x.st_shndx;
+			sym.value = x.st_value;
+
+			if (sym.shndx == SHN_UNDEF || sym.shndx == SHN_ABS || sym.shndx == SHN_COMMON) continue;
+			if (sym.shndx >= obj.sections.size()) throw_elf_error("bad symbol section");
+		}
+
+
+		// pass 2 - decode the relocation records.
+		sh_num = -1;
+		for (const auto &s : sections) {
+			++sh_num;
+			if (s.sh_type != SHT_REL && s.sh_type != SHT_RELA) continue;
+
+
+			// sh_link is the associated symbol table.
+			// sh_info is the associated data section 
+
+			if (current_st != s.sh_link) {
+				throw_elf_error("bad symbol table reference");
+			}
+			if (s.sh_info >= obj.sections.size()) {
+				throw_elf_error("bad relocation section");
+			}
+			// relocations for something we don't merge (debug info, etc)
+			if (obj.sections[s.sh_info].type == 0) continue;
+
+			if (obj.relocs.empty()) obj.relocs = _scratch.relocs.acquire(header.e_shnum);
+			// decoded during the merge, directly into the section.
+			auto &ir = obj.relocs.emplace_back();
+			ir.section = s.sh_info;
+			ir.relocs = reloc_cursor(file, s);
+		}
+
+		if (flags.i) obj.signature = object_signature(obj);
+
+	} catch(std::exception &ex) {
+		if (fd >= 0) close(fd);
+		obj.file.reset();
+		obj.error = ex.what();
+	}
+}
+
+
+// merge a parsed file into the global sections and symbols.
+// files must be merged in command-line order.
+int link_state::merge_file(input_object &obj) {
+
+	// 1. merge sections
+	// 2. update symbols
+	// 3. process relocation records that refer to a private symbol????
+	// 4. add relocation records ()
+
+	const std::string &filename = obj.filename;
+
+	if (flags.v) printf("%s...\n", filename.c_str());
+
+	if (obj.open_error) {
+		if (obj.optional && obj.missing) {
+			if (flags.i && obj.journal) {
+				auto &j = _journal_inputs.emplace_back();
+				j.filename = filename;
+				j.missing = true;
+				_journal_placements.emplace_back();
+			}
+			return 0;
+		}
+		error("open " + filename + ": " + obj.error, filename);
+		return -1;
+	}
+	if (!obj.error.empty()) {
+		error(filename + ": " + obj.error, filename);
+		return -1;
+	}
+	if (obj.library) {
+		// journaled so an unchanged library doesn't stop an incremental link.
+		if (flags.i && obj.journal) {
+			_journal_inputs.emplace_back().filename = filename;
+			_journal_placements.emplace_back();
+		}
+		open_library(filename);
+		return 0;
+	}
+
+	auto local_section_map = _scratch.local_sections.acquire(obj.sections.size() + 1);
+	local_section_map.resize(obj.sections.size() + 1);
+
+	std::vector<journal_placement> *placements = nullptr;
+	if (flags.i && obj.journal) {
+		auto &j = _journal_inputs.emplace_back();
+		j.filename = filename;
+		j.signature = obj.signature;
+		placements = &_journal_placements.emplace_back();
+	}
+
+
+	// pass 1 - merge SHT_PROGBITS and SHT_NOBITS
+	int sh_num = -1;
+	for (const auto &s : obj.sections) {
+
+		++sh_num;
+		if (!s.type) continue;
+
+		std::string_view name = s.name;
+
+		if (s.type == TYPE_BSS) {
+
+
+			section &gs = find_section(name);
+			if (gs.type == 0) gs.type = TYPE_BSS;
+
+
+			if (gs.type != TYPE_BSS)
+				fail(filename + ": " + std::string(name) + " - section type mismatch", filename);
+
+
+			gs.align = std::max(gs.align, s.align);
+			if (gs.align > 1) {
+				unsigned mask = gs.align - 1;
+				gs.bss_size = (gs.bss_size + mask) & ~mask;
+			}				
+
+			local_section_map[sh_num].section = gs.id;
+			local_section_map[sh_num].offset = gs.bss_size;
+
+			gs.bss_size += s.size;
+			continue;
+		}
+
+		section &gs = find_section(name);
+		if (gs.type == 0) {
+			gs.type = s.type;
+		}
+		if (gs.type != s.type) {
+			fail(filename + ":" + std::string(name) + " - section type mismatch", filename);
+		}
+
+		// only the size is needed now.  the data is copied directly into
+		// the omf segment once the layout is known.
+		gs.align = std::max(gs.align, s.align);
+
+		if (gs.align > 1) {
+			unsigned mask = (gs.align - 1);
+			gs.data_size = (gs.data_size + mask) & ~mask;
+		}
+
+		local_section_map[sh_num].section = gs.id;
+		local_section_map[sh_num].offset = gs.data_size;
+
+		if (!s.data.empty()) {
+			auto &f = gs.fragments.emplace_back();
+			f.offset = gs.data_size;
+			f.data = s.data;
+			if (placements) placements->push_back(journal_placement{ gs.id, f.offset, (uint32_t)s.data.size() });
+		}
+		gs.data_size += s.data.size();
+	}
+
+
+
+	// pass 1.5 -- merge the symbol table.
+	// local symbols go into the global symbol table but not the global symbol table map.
+	auto symbol_to_symbol = _scratch.symbol_to_symbol.acquire(obj.symbols.size());
+
+
+	for (const auto &x : obj.symbols) {
+
+		// copy global/weak symbols to the global symbol table
+		// skip local symbols.
+		unsigned bind = x.bind;
+
+		if (!x.named) {
+			// section symbols; anything else unnamed can't be referenced.
+			if (x.shndx == SHN_UNDEF || x.shndx >= SHN_LORESERVE || !local_section_map[x.shndx].section) {
+				symbol_to_symbol.push_back(0);
+				continue;
+			}
+			symbol &sym = local_symbol("");
+			sym.section = local_section_map[x.shndx].section;
+			sym.offset = x.value + local_section_map[x.shndx].offset;
+			symbol_to_symbol.push_back(sym.id);
+			continue;
+		}
+		std::string_view name = x.name;
+
+
+		// todo -- the .calypsi_info section can make some undefined references
+		// a .require-ment. (also noreorder, others?)
+
+
+		symbol &sym = bind == STB_LOCAL ? local_symbol(name) : find_symbol(name);
+
+		symbol_to_symbol.push_back(sym.id);
+
+		bool required = false; // todo....
+		if (required) sym.count++;
+
+		if (x.shndx == 0) continue;
+
+		if (sym.section == 0) {
+			// new symbol!  let's define it
+			// todo -- SHN_COMMON?
+
+			if (bind == STB_WEAK) sym.weak = true;
+
+			if (x.shndx == SHN_COMMON) {
+				fail("SHN_COMMON not yet supported.", filename);
+			}
+			if (x.shndx == SHN_ABS) {
+				sym.absolute = true;
+				sym.offset = x.value;
+				sym.section = -1;
+			} else {
+				// SHN_UNDEF handled above.
+				sym.section = local_section_map[x.shndx].section;
+				sym.offset = x.value + local_section_map[x.shndx].offset;
+			}
+
+		 } else {
+
+		 	// known symbol.  weak is ok, otherwise, warn.
+			if (bind == STB_GLOBAL) {
+				// allow duplicate absolute symbols?
+				error(filename + ": duplicate symbol (" + std::string(name) + ")", filename);
+				continue;
+			}
+		}
+	}
+
+
+	// pass 2 - process the relocation records.
+	for (const auto &ir : obj.relocs) {
+
+		unsigned section_offset = local_section_map[ir.section].offset;
+		unsigned section_id = local_section_map[ir.section].section;
+
+		section &gs = _sections[section_id - 1];
+
+		auto &relocs = gs.relocs;
+		size_t needed = relocs.size() + ir.relocs.size();
+		if (needed > relocs.capacity())
+			relocs.reserve(std::max(needed, relocs.capacity() * 2));
+
+		for (size_t i = 0; i < ir.relocs.size(); ++i) {
+			const Elf32_Rela r = ir.relocs[i];
+			int rsym = ELF32_R_SYM(r.r_info);
+			int rtype = ELF32_R_TYPE(r.r_info);
+
+			if (rsym >= symbol_to_symbol.size() || !symbol_to_symbol[rsym]) {
+				error(filename + ": bad relocation", filename);
+				continue;
+			}
+
+			auto &sym = _symbols[symbol_to_symbol[rsym] - 1];
+			sym.count++;
+
+			reloc rr;
+
+			rr.offset = section_offset + r.r_offset;
+
+			rr.type = rtype;
+			rr.value = r.r_addend;
+			rr.symbol = sym.id;
+			relocs.push_back(rr);
+		}
+	}
+
+	_scratch.symbol_to_symbol.release(symbol_to_symbol);
+	_scratch.local_sections.release(local_section_map);
+
+	// the views stay valid since the file is kept mapped.
+	if (obj.store) {
+		auto &p = _cache_pending.emplace_back();
+		p.hash = obj.hash;
+		p.sections = std::move(obj.sections);
+		p.symbols = std::move(obj.symbols);
+		p.relocs = std::move(obj.relocs);
+	}
+
+	if (obj.file) _files.emplace_back(std::move(obj.file));
+	if (obj.cached) _cache_entries.emplace_back(std::move(obj.cached));
+	return 0;
+}
+
+
+// use the section headers (read while prefetching) to size the global
+// containers once, rather than letting them grow one file at a time.
+// These are upper bounds: duplicate global and undefined symbols are
+// counted once per file.
+void link_state::plan_capacity(const std::vector<input_object> &objects) {
+
+	std::unordered_set<std::string_view> names;
+
+	for (const auto &obj : objects) {
+		const auto &summary = obj.summary;
+		if (!summary.valid) continue;
+
+		_plan.symbols += summary.symbols;
+		_plan.global_symbols += summary.symbols - summary.local_symbols;
+
+		for (const auto &s : summary.sections) {
+			names.insert(s.name);
+			_plan.relocs += s.relocs;
+			if (!s.relocs) continue;
+
+			hashed_name key(s.name);
+			auto iter = _plan.section_relocs.find(key);
+			if (iter != _plan.section_relocs.end()) {
+				iter->second += s.relocs;
+				continue;
+			}
+			key.name = _names.copy(s.name);
+			_plan.section_relocs.emplace(key, s.relocs);
+		}
+	}
+	_plan.sections = names.size();
+
+	_sections.reserve(_sections.size() + _plan.sections);
+	_section_map.reserve(_section_map.size() + _plan.sections);
+	_symbols.reserve(_symbols.size() + _plan.symbols);
+	_symbol_map.reserve(_symbol_map.size() + _plan.global_symbols);
+}
+
+// parse the files on a worker pool, then merge them in order so the
+// results are identical to a serial link.
+void link_state::process_files(std::vector<input_object> &objects) {
+
+	// parse and merge in batches so a merged file's buffers can be reused
+	// by the files parsed after it.
+	size_t batch = flags.jobs * 4;
+	for (size_t first = 0; first < objects.size(); first += batch) {
+		size_t count = std::min(batch, objects.size() - first);
+
+		parallel_for(flags.jobs, count, [&](size_t i){
+			parse_file(objects[first + i]);
+		});
+
+		for (size_t i = first; i < first + count; ++i) {
+			auto &obj = objects[i];
+			merge_file(obj);
+			release_buffers(obj);
+		}
+	}
+}
+
+void link_state::load_files(const std::vector<input_spec> &inputs) {
+
+	std::vector<input_object> objects(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		objects[i].filename = inputs[i].filename;
+		objects[i].optional = inputs[i].optional;
+		objects[i].data = inputs[i].data;
+		objects[i].size = inputs[i].size;
+		objects[i].journal = true;
+	}
+
+	// issue all the reads up front, before anything blocks on them.  A
+	// check (-n) never reads the section data.
+	parallel_for(flags.jobs, objects.size(), [&](size_t i){
+		prefetch_file(objects[i], !flags.n);
+	});
+
+	if (std::any_of(objects.begin(), objects.end(), [](const input_object &obj){ return obj.stream; })) {
+		std::vector<input_object> tmp;
+		tmp.reserve(objects.size());
+		for (auto &obj : objects) {
+			if (obj.stream) read_stream(obj, tmp);
+			else tmp.emplace_back(std::move(obj));
+		}
+		objects = std::move(tmp);
+	}
+
+	_input_maps.clear();
+
+	plan_capacity(objects);
+	process_files(objects);
+
+	if (flags.v) {
+		printf("Scratch buffers: %u requests, %u reused\n",
+			_scratch.stats.requests.load(), _scratch.stats.reused.load());
+		if (_cache)
+			printf("Object cache: %u hits, %u misses\n",
+				_cache->hits.load(), _cache->misses.load());
+		if (resident)
+			printf("Resident objects: %u reused, %zu parsed\n",
+				resident_hits.load(), parsed.size());
+
+		unsigned relocs = 0;
+		for (const auto &s : _sections) relocs += s.relocs.size();
+
+		printf("Capacity (planned/actual):\n");
+		printf("  sections       %u/%zu\n", _plan.sections, _sections.size());
+		printf("  symbols        %u/%zu\n", _plan.symbols, _symbols.size());
+		printf("  global symbols %u/%zu\n", _plan.global_symbols, _symbol_map.size());
+		printf("  relocations    %u/%u\n", _plan.relocs, relocs);
+	}
+}
+
+void link_state::open_library(const std::string &path) {
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) fail("open " + path + ": " + strerror(errno));
+
+	try {
+		uint8_t magic[8];
+		if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && archive::is_archive(magic, sizeof(magic)))
+			_libraries.emplace_back(new archive(fd, path));
+		else
+			_omf_libraries.emplace_back(new omf_library(fd, path));
+	} catch (std::exception &ex) {
+		close(fd);
+		fail(path + ": " + ex.what());
+	}
+	close(fd);
+}
+
+void link_state::open_directory(const std::string &dir) {
+	try {
+		_directories.emplace_back(new symbol_index(dir));
+	} catch (std::exception &ex) {
+		fail(std::string(ex.what()) + " (use -I " + dir + " to build an index)");
+	}
+}
+
+// resolve undefined symbols from the libraries, then the indexed
+// directories.  Only the members/files that define a currently undefined
+// symbol are loaded.  Loading them can add new undefined symbols so repeat
+// until nothing changes.
+void link_state::search_libraries(void) {
+
+	if (_libraries.empty() && _omf_libraries.empty() && _directories.empty()) return;
+
+	// library (archives, then omf) or directory index << 32 | member offset or file number
+	std::unordered_set<uint64_t> loaded;
+
+	for(;;) {
+		std::vector<input_object> objects;
+
+		for (const auto &sym : _symbols) {
+			if (sym.section || sym.absolute || sym.local || !sym.count) continue;
+
+			bool found = false;
+
+			for (size_t lib = 0; lib < _libraries.size(); ++lib) {
+				const auto &ar = *_libraries[lib];
+				uint32_t offset = ar.find(sym.name);
+				if (!offset) continue;
+
+				if (loaded.insert((uint64_t)lib << 32 | offset).second) {
+					auto &obj = objects.emplace_back();
+					obj.filename = ar.name() + "(" + ar.member_name(offset) + ")";
+					try {
+						obj.file = ar.open_member(offset);
+					} catch (std::exception &ex) {
+						obj.error = ex.what();
+					}
+				}
+				found = true;
+				break;
+			}
+			if (found) continue;
+
+			for (size_t lib = 0; lib < _omf_libraries.size(); ++lib) {
+				const auto &ol = *_omf_libraries[lib];
+				uint32_t offset = ol.find(sym.name);
+				if (!offset) continue;
+
+				size_t key = _libraries.size() + lib;
+				if (loaded.insert((uint64_t)key << 32 | offset).second) {
+					auto &obj = objects.emplace_back();
+					obj.filename = ol.name() + "(" + ol.member_name(offset) + ")";
+					obj.data = ol.member_data(offset, obj.size);
+				}
+				found = true;
+				break;
+			}
+			if (found) continue;
+
+			for (size_t i = 0; i < _directories.size(); ++i) {
+				const auto &dir = *_directories[i];
+				int n = dir.find(sym.name);
+				if (n < 0) continue;
+
+				size_t key = _libraries.size() + _omf_libraries.size() + i;
+				if (loaded.insert((uint64_t)key << 32 | n).second) {
+					auto &obj = objects.emplace_back();
+					obj.filename = dir.path(n);
+					try {
+						obj.fd = dir.open(n);
+					} catch (std::exception &ex) {
+						obj.error = ex.what();
+					}
+				}
+				break;
+			}
+		}
+
+		if (objects.empty()) break;
+		process_files(objects);
+	}
+}
+
+
+int link_state::one_file(const std::string &filename) {
+	// process one elf file.
+	input_object obj;
+	obj.filename = filename;
+	parse_file(obj);
+	int rv = merge_file(obj);
+	release_buffers(obj);
+	return rv;
+}
+
+void link_state::init(void) {
+
+// idea... create empty placeholder register, tiny, ztiny, stack segments
+// so they're in the order I want them?
+
+#if 0
+	// create dp/stack segment for 
+	// this does not go in the name map.
+	{
+		auto &s = _sections.emplace_back();
+		s.name = "dp/stack";
+		s.id = 1;
+	}
+
+	{
+		auto &sym = find_symbol("_DirectPageStart");
+		sym.section = 1;
+	}
+	// todo -- "_NearBaseAddress" --> near data bank. 
+#endif
+}
+
+// hash the contents of the inputs and libraries (in parallel) into
+// _content_hashes.  Returns false if any of them can't be hashed
+// (streams, in-memory objects, unreadable files).  Missing optional inputs
+// are left out.
+bool link_state::hash_inputs(const std::vector<input_spec> &inputs, const std::vector<std::string> &libraries) {
+
+	int &rv = _hashed;
+	if (rv >= 0) return rv;
+
+	std::vector<std::string> paths;
+	std::vector<bool> optional;
+	for (const auto &spec : inputs) {
+		paths.push_back(spec.filename);
+		optional.push_back(spec.optional);
+	}
+	for (const auto &path : libraries) {
+		paths.push_back(path);
+		optional.push_back(false);
+	}
+
+	enum { ok, missing, uncacheable };
+	std::vector<uint64_t> hashes(paths.size());
+	std::vector<std::shared_ptr<uint8_t>> maps(paths.size());
+	std::vector<size_t> sizes(paths.size());
+	std::vector<int> status(paths.size(), ok);
+
+	for (const auto &spec : inputs)
+		if (spec.data) {
+			rv = 0;
+			return false;
+		}
+
+	parallel_for(flags.jobs, paths.size(), [&](size_t i){
+		if (paths[i] == "-") {
+			status[i] = uncacheable;
+			return;
+		}
+		int fd = open(paths[i].c_str(), O_RDONLY);
+		if (fd < 0) {
+			status[i] = optional[i] && errno == ENOENT ? missing : uncacheable;
+			return;
+		}
+		maps[i] = object_cache::map(fd, sizes[i]);
+		close(fd);
+		if (!maps[i]) {
+			status[i] = uncacheable;
+			return;
+		}
+		hashes[i] = object_cache::hash(maps[i].get(), sizes[i]);
+	});
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+		if (maps[i]) _input_maps.emplace(paths[i], std::make_pair(maps[i], sizes[i]));
+
+	rv = std::none_of(status.begin(), status.end(), [](int x){ return x == uncacheable; });
+	if (rv) {
+		for (size_t i = 0; i < paths.size(); ++i)
+			if (status[i] == ok) _content_hashes.emplace(paths[i], hashes[i]);
+	}
+	return rv;
+}
+
+// the options that affect the output's contents.
+std::string link_state::option_string(void) {
+	return "stack " + std::to_string(flags.stack) + " " + std::to_string(flags.S)
+		+ " omf " + std::to_string(flags.omf_flags)
+		+ " type " + std::to_string(flags.file_type) + " " + std::to_string(flags.aux_type);
+}
+
+// hash everything that determines the output: the options and the
+// contents of the inputs and libraries, in order.  The output name isn't
+// included since it doesn't affect the contents.  Returns 0 if the link
+// can't be cached (streams, indexed directories).
+uint64_t link_state::link_key(const std::vector<input_spec> &inputs, const std::vector<std::string> &libraries) {
+
+	if (!_directories.empty()) return 0;
+	if (!hash_inputs(inputs, libraries)) return 0;
+
+	std::string key = "elf2omf " ELF2OMF_VERSION "\n";
+	key += option_string() + "\n";
+
+	auto add = [&](const char *tag, const std::string &path) {
+		auto iter = _content_hashes.find(path);
+		key += tag;
+		key += iter == _content_hashes.end() ? "missing" : std::to_string(iter->second);
+		key += "\n";
+	};
+	for (const auto &spec : inputs) add("input ", spec.filename);
+	for (const auto &path : libraries) add("library ", path);
+
+	uint64_t rv = object_cache::hash((const uint8_t *)key.data(), key.size());
+	return rv ? rv : 1;
+}
+
+// record the layout of a full link for the next incremental link.
+void link_state::write_journal(const std::vector<omf::segment> &segments) {
+
+	std::string path = link_journal::path(flags.o);
+
+	if (errors) {
+		unlink(path.c_str());
+		return;
+	}
+
+	link_journal journal;
+	journal.options = option_string();
+
+	// (libraries named as inputs are journaled with the inputs.)
+	for (const auto &path : library_paths)
+		journal.libraries.emplace_back(path, _content_hashes[path]);
+
+	for (size_t i = 0; i < _journal_inputs.size(); ++i) {
+		auto &j = journal.inputs.emplace_back(std::move(_journal_inputs[i]));
+		if (!j.missing) j.hash = _content_hashes[j.filename];
+
+		for (const auto &p : _journal_placements[i]) {
+			const auto &gs = _sections[p.section - 1];
+			const auto &seg = segments[gs.omf_segment - 1];
+			j.ranges.emplace_back(seg.data_offset + gs.omf_offset + p.offset, p.size);
+		}
+	}
+
+	struct stat st;
+	if (stat(flags.o.c_str(), &st) == 0) {
+		journal.output = symbol_index::make_stamp(st);
+		if (journal.write(path)) return;
+	}
+	warning("Unable to write " + path);
+}
+
+// copy an object's new section data over its old data in the output,
+// keeping the bytes under relocations (which are known to be unchanged).
+bool patch_object(int fd, const input_object &obj, const link_journal::input &j) {
+
+	size_t n = 0;
+	std::vector<uint8_t> buffer;
+	std::vector<bool> keep;
+
+	for (unsigned sh = 0; sh < obj.sections.size(); ++sh) {
+		const auto &s = obj.sections[sh];
+		if (!s.type || s.type == TYPE_BSS || s.data.empty()) continue;
+		if (n >= j.ranges.size()) return false;
+
+		auto [offset, size] = j.ranges[n++];
+		if (size != s.data.size()) return false;
+
+		buffer.resize(size);
+		if (pread(fd, buffer.data(), size, offset) != size) return false;
+
+		keep.assign(size, false);
+		for (const auto &ir : obj.relocs) {
+			if (ir.section != sh) continue;
+			for (size_t i = 0; i < ir.relocs.size(); ++i) {
+				uint64_t first = ir.relocs[i].r_offset;
+				for (uint64_t k = first; k < first + fixup_size && k < size; ++k)
+					keep[k] = true;
+			}
+		}
+
+		for (uint32_t k = 0; k < size; ++k)
+			if (!keep[k]) buffer[k] = s.data[k];
+
+		if (pwrite(fd, buffer.data(), size, offset) != size) return false;
+	}
+	return n == j.ranges.size();
+}
+
+// if only the section data of some inputs changed since the last link,
+// patch the previous output in place rather than relinking.  The result
+// is identical to a full link.  Returns false if a full link is needed.
+bool link_state::incremental_link(const std::vector<input_spec> &inputs, const std::vector<std::string> &libraries) {
+
+	std::string path = link_journal::path(flags.o);
+
+	link_journal journal;
+	if (!journal.read(path)) return false;
+	if (journal.options != option_string()) return false;
+
+	struct stat st;
+	if (stat(flags.o.c_str(), &st) < 0 || symbol_index::make_stamp(st) != journal.output) return false;
+
+	if (journal.libraries.size() != libraries.size()) return false;
+	for (size_t i = 0; i < libraries.size(); ++i) {
+		const auto &l = journal.libraries[i];
+		if (l.first != libraries[i] || l.second != _content_hashes[libraries[i]]) return false;
+	}
+
+	if (journal.inputs.size() != inputs.size()) return false;
+
+	std::vector<input_object> changed;
+	std::vector<size_t> which;
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		const auto &j = journal.inputs[i];
+		const auto &name = inputs[i].filename;
+		if (j.filename != name) return false;
+
+		auto iter = _content_hashes.find(name);
+		bool missing = iter == _content_hashes.end();
+		if (missing != j.missing) return false;
+		if (missing || iter->second == j.hash) continue;
+
+		changed.emplace_back().filename = name;
+		which.push_back(i);
+	}
+
+	if (changed.empty()) {
+		if (flags.v) printf("Incremental: up to date\n");
+		return true;
+	}
+
+	parallel_for(flags.jobs, changed.size(), [&](size_t i){
+		parse_file(changed[i]);
+	});
+
+	bool ok = true;
+	for (size_t i = 0; i < changed.size(); ++i) {
+		const auto &obj = changed[i];
+		if (!obj.error.empty() || obj.library || obj.signature != journal.inputs[which[i]].signature) ok = false;
+	}
+
+	if (ok) {
+		int fd = open(flags.o.c_str(), O_RDWR);
+		if (fd < 0) ok = false;
+		for (size_t i = 0; ok && i < changed.size(); ++i) {
+			auto &j = journal.inputs[which[i]];
+			ok = patch_object(fd, changed[i], j);
+			j.hash = _content_hashes[j.filename];
+		}
+		if (fd >= 0 && close(fd) < 0) ok = false;
+		if (!ok) warning(flags.o + ": unable to patch, relinking");
+	}
+
+	for (auto &obj : changed) release_buffers(obj);
+	if (!ok) return false;
+
+	if (stat(flags.o.c_str(), &st) == 0) {
+		journal.output = symbol_index::make_stamp(st);
+		journal.write(path);
+	}
+
+	if (flags.v) printf("Incremental: patched %zu of %zu inputs\n", changed.size(), inputs.size());
+	return true;
+}
+
+// write new cache entries (parsed objects and the output file) and trim the
+// cache.  In the background, this is done in a child process once the output
+// file is written so a cold cache doesn't slow down the link.
+void link_state::update_cache(bool background) {
+
+	if (!_cache || failed) return;
+
+	// don't cache the output of a link that had errors.
+	if (errors) _link_key = 0;
+	if (_cache_pending.empty() && !_link_key) return;
+
+	pid_t pid = -1;
+	if (background) {
+		fflush(stdout);
+		fflush(stderr);
+
+		// the work is done by a grandchild, which init reaps, so the
+		// caller never has a child to wait for.
+		pid = fork();
+		if (pid > 0) {
+			while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) ;
+			return;
+		}
+		if (pid == 0 && fork() != 0) _exit(0);
+	}
+
+	if (pid == 0) {
+		// stay out of the way of whatever runs next, and don't hold the
+		// caller's pipes open.
+#ifdef SCHED_IDLE
+		struct sched_param param = {};
+		sched_setscheduler(0, SCHED_IDLE, &param);
+#else
+		nice(19);
+#endif
+		int fd = open("/dev/null", O_RDWR);
+		if (fd >= 0) {
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			if (fd > STDERR_FILENO) close(fd);
+		}
+	}
+
+	for (const auto &p : _cache_pending)
+		_cache->store(p.hash, p.sections, p.symbols, p.relocs);
+	if (_link_key)
+		_cache->store_output(_link_key, flags.o);
+	_cache->evict(flags.cache_size, flags.cache_days);
+
+	if (pid == 0) _exit(0);
+}
+
+
+void link_state::diagnose(link_diagnostic::kind level, const std::string &message, const std::string &file) {
+	link_diagnostic d;
+	d.level = level;
+	d.file = file;
+	d.message = message;
+	diagnose(std::move(d));
+}
+
+void link_state::diagnose(link_diagnostic &&d) {
+	// errors still produce an output, but it's not cached or journaled.
+	if (d.level == link_diagnostic::error) ++errors;
+	diagnostics.emplace_back(std::move(d));
+	if (report && *report) (*report)(diagnostics.back());
+}
+
+link_state::link_state(const link_options &options) : flags(options) {
+	if (!flags.jobs) flags.jobs = default_jobs();
+}
+
+bool link_state::link() {
+
+	bool journal = flags.i && !flags.r && !flags.n && !flags.o.empty();
+
+	try {
+		init();
+
+		for (const auto &path : library_paths)
+			open_library(path);
+		for (const auto &dir : directory_paths)
+			open_directory(dir);
+
+		// the output cache and incremental links work on the output file.
+		// (a check doesn't use the cache, which would hash all of every input.)
+		if (!flags.c.empty() && !flags.n) {
+			try {
+				_cache.reset(new object_cache(flags.c));
+			} catch (std::exception &ex) {
+				fail(ex.what());
+			}
+
+			if (!flags.o.empty() && !flags.r) _link_key = link_key(inputs, library_paths);
+			if (_link_key && _cache->load_output(_link_key, flags.o)) {
+				if (flags.v) printf("Output cache hit\n");
+				_link_key = 0;
+				return true;
+			}
+		}
+
+		// only plain files can be checked for changes.
+		if (flags.r || flags.n) flags.i = false;
+		if (flags.i && (flags.o.empty() || !_directories.empty() || !hash_inputs(inputs, library_paths))) {
+			if (flags.v) printf("Incremental link disabled (streams or -d)\n");
+			flags.i = false;
+		}
+		if (flags.i && incremental_link(inputs, library_paths)) {
+			_link_key = 0;
+			return true;
+		}
+
+		load_files(inputs);
+		search_libraries();
+
+
+		// debug - dump sections
+		if (flags.v) {
+			printf("Sections:\n");
+			for (const auto &s : _sections) {
+				printf("% 3d %-16.*s %u\n", s.id, (int)s.name.size(), s.name.data(), s.data_size);
+			}
+			printf("Symbols:\n");
+			for (const auto &s : _symbols) {
+				char m = ' ';
+				if (s.section == 0) m = '?';
+				else if (s.section == -1) m = '#'; // abs
+				printf("% 3d %c %-16.*s\n", s.id, m, (int)s.name.size(), s.name.data());
+			}
+		}
+
+		// a partial link leaves the undefined (and linker generated)
+		// symbols for the final link.
+		if (flags.r) {
+			to_elf();
+			return !failed;
+		}
+
+		generate_linker_symbols();
+		if (!check_for_missing_symbols()) {
+			failed = true;
+			return false;
+		}
+		to_omf();
+
+	} catch (link_error &ex) {
+		diagnose(link_diagnostic::fatal, ex.what(), ex.file);
+		failed = true;
+	} catch (output_error &ex) {
+		link_diagnostic d;
+		d.level = link_diagnostic::fatal;
+		d.message = ex.what();
+		d.output = ex.kind;
+		d.error_number = ex.code().value();
+		diagnose(std::move(d));
+		failed = true;
+	} catch (std::exception &ex) {
+		diagnose(link_diagnostic::fatal, ex.what());
+		failed = true;
+	}
+
+	// a link with errors never leaves a journal behind, even when it
+	// couldn't be incremental, so the next -i link is a full one and
+	// reports them again.
+	if (journal && (failed || errors)) unlink(link_journal::path(flags.o).c_str());
+	return !failed;
+}
+
+
+std::string absolute_path(const std::string &path) {
+	if (path.empty() || path.front() == '/') return path;
+	char buffer[PATH_MAX];
+	if (!getcwd(buffer, sizeof(buffer))) return path;
+	return std::string(buffer) + "/" + path;
+}
+
+
+link_context::link_context(const link_options &options) : _state(new link_state(options)) {
+	_state->report = &report;
+}
+
+link_context::~link_context() {
+}
+
+void link_context::add_file(const std::string &path, bool optional) {
+	auto &spec = _state->inputs.emplace_back();
+	spec.filename = path;
+	spec.optional = optional;
+}
+
+void link_context::add_object(const std::string &name, const void *data, size_t size) {
+	auto &spec = _state->inputs.emplace_back();
+	spec.filename = name;
+	spec.data = (const uint8_t *)data;
+	spec.size = size;
+}
+
+void link_context::add_library(const std::string &path) {
+	_state->library_paths.push_back(path);
+}
+
+void link_context::add_directory(const std::string &dir) {
+	_state->directory_paths.push_back(dir);
+}
+
+void link_context::use_resident(const resident_map *objects) {
+	_state->resident = objects;
+}
+
+std::vector<std::string> link_context::parsed() const {
+	std::lock_guard<std::mutex> lock(_state->parsed_mutex);
+	return _state->parsed;
+}
+
+bool link_context::link() {
+	return _state->link();
+}
+
+const std::vector<uint8_t> &link_context::image() const {
+	return _state->image;
+}
+
+const std::string &link_context::plan() const {
+	return _state->plan;
+}
+
+const std::vector<link_diagnostic> &link_context::diagnostics() const {
+	return _state->diagnostics;
+}
+
+unsigned link_context::errors() const {
+	return _state->errors;
+}
+
+void link_context::update_cache(bool background) {
+	_state->update_cache(background);
+}
+
+void link_context::parse_resident(const std::vector<std::string> &paths, resident_map &objects, unsigned jobs) {
+
+	link_options options;
+	options.jobs = jobs;
+	link_state state(options);
+
+	std::vector<input_object> parsed(paths.size());
+	std::vector<symbol_index::stamp> stamps(paths.size());
+
+	parallel_for(state.flags.jobs, paths.size(), [&](size_t i){
+		// stamp first, so a change during the parse is caught next time.
+		struct stat st;
+		parsed[i].filename = paths[i];
+		if (stat(paths[i].c_str(), &st) < 0) {
+			parsed[i].error = strerror(errno);
+			return;
+		}
+		stamps[i] = symbol_index::make_stamp(st);
+		state.parse_file(parsed[i]);
+	});
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		auto &obj = parsed[i];
+		if (!obj.error.empty() || !obj.file) {
+			objects.erase(paths[i]);
+		} else {
+			auto &ro = objects[paths[i]];
+			ro.stamp = stamps[i];
+			ro.file = std::move(obj.file);
+			ro.sections.assign(obj.sections.begin(), obj.sections.end());
+			ro.symbols.assign(obj.symbols.begin(), obj.symbols.end());
+			ro.relocs.assign(obj.relocs.begin(), obj.relocs.end());
+		}
+		state.release_buffers(obj);
+	}
+}
@@ -0,0 +1,149 @@
+#ifndef __link_context_h__
+#define __link_context_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "input.h"
+#include "symbol_index.h"
+
+/*
+ * The linker as a library.  All of a link's state lives in its
+ * link_context so several links can run at once in one process (each
+ * one still uses up to options.jobs threads).
+ *
+ *	link_options options;
+ *	options.stack = 0x800;
+ *	link_context ctx(options);
+ *	ctx.add_object("main.o", data, size);
+ *	if (ctx.link()) use(ctx.image());
+ *	else for (const auto &d : ctx.diagnostics()) ...
+ */
+
+struct link_options {
+	bool v = false; // verbose (to stdout)
+	bool S = false;
+	std::string o; // output file; empty to link to memory (see image())
+
+	bool r = false; // partial link: write a merged elf object rather than omf
+	bool x = false; // with r, leave out the local symbols
+	bool n = false; // check only: resolve symbols and plan the layout (see plan())
+
+	bool i = false; // incremental
+	std::string c; // cache directory
+	uint64_t cache_size = 0; // 0 = unlimited
+	unsigned cache_days = 0;
+
+	unsigned stack = 0;
+	uint16_t file_type = 0;
+	uint32_t aux_type = 0;
+
+	unsigned omf_flags = 0;
+	unsigned jobs = 0; // 0 = default_jobs()
+};
+
+struct link_diagnostic {
+	enum kind {
+		warning,
+		error, // the output is still written
+		fatal, // the link was abandoned
+	};
+
+	// a fatal error creating or writing the output file keeps the errno,
+	// so the command line can exit with the matching sysexits code.
+	enum output_kind {
+		no_output_error,
+		output_create,
+		output_write,
+	};
+
+	kind level = error;
+	std::string file; // the input it concerns, if any
+	std::string message; // complete message, as printed
+	output_kind output = no_output_error;
+	int error_number = 0;
+};
+
+// an object parsed ahead of time, by absolute path.  A link uses it in
+// place of the file as long as the file's size and mtime are unchanged.
+struct resident_object {
+	symbol_index::stamp stamp;
+	std::shared_ptr<elf_file> file;
+	std::vector<input_section> sections;
+	std::vector<input_symbol> symbols;
+	std::vector<input_relocs> relocs;
+};
+
+typedef std::unordered_map<std::string, resident_object> resident_map;
+
+// path made absolute, relative to the current directory.
+std::string absolute_path(const std::string &path);
+
+class link_state;
+
+class link_context {
+
+	std::unique_ptr<link_state> _state;
+
+public:
+
+	// called as each diagnostic is issued, from the linking thread.
+	std::function<void(const link_diagnostic &)> report;
+
+	explicit link_context(const link_options &options);
+	~link_context();
+
+	link_context(const link_context &) = delete;
+	link_context &operator=(const link_context &) = delete;
+
+	// inputs, in link order.  Nothing is read until link().  "-" is stdin.
+	void add_file(const std::string &path, bool optional = false);
+
+	// an object in memory.  The data isn't copied and must outlive the
+	// context.
+	void add_object(const std::string &name, const void *data, size_t size);
+
+	// archives and indexed directories, searched for undefined symbols
+	// once all the inputs are loaded.
+	void add_library(const std::string &path);
+	void add_directory(const std::string &dir);
+
+	// reuse these objects (see resident_object) rather than parsing the
+	// files.  The inputs which had to be parsed are listed by parsed().
+	void use_resident(const resident_map *objects);
+	std::vector<std::string> parsed() const;
+
+	// link, and write the output file (or build the image).  Returns
+	// false if the link failed; errors that still produce an output (eg,
+	// duplicate symbols) are only reported.
+	bool link();
+
+	// the OMF file (or the elf object, with options.r) when options.o is empty.
+	const std::vector<uint8_t> &image() const;
+
+	// with options.n, the planned segment layout as JSON.  Nothing is
+	// written and the section data is never read.  If the sections don't
+	// fit in one segment the plan is still made (with "fits": false) but
+	// the link fails.
+	const std::string &plan() const;
+
+	const std::vector<link_diagnostic> &diagnostics() const;
+	unsigned errors() const;
+
+	// write new cache entries and trim the cache (-c).  In the background
+	// a low priority, detached grandchild does it (so there's nothing to
+	// reap); only use that in a process which doesn't have other threads
+	// running.
+	void update_cache(bool background);
+
+	// parse paths into objects, on up to jobs threads.  Files which
+	// can't be parsed are removed from objects.
+	static void parse_resident(const std::vector<std::string> &paths, resident_map &objects, unsigned jobs);
+};
+
+#endif
@@ -0,0 +1,506 @@
+#include "object_cache.h"
+#include "version.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <climits>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+/*
+ * Entry layout (native byte order):
+ *
+ *   header
+ *   cache_section[sections]
+ *   cache_symbol[symbols]
+ *   cache_relocs[reloc_sets]
+ *   Elf32_Rela[relocs]
+ *   char strings[strings_size]
+ *   section data
+ */
+
+static const char cache_magic[8] = { 'E', '2', 'O', 'C', 'A', 'C', 'H', 'E' };
+static const uint32_t cache_bom = 0x01020304;
+
+namespace {
+
+	struct header {
+		char magic[8];
+		char version[16];
+		uint32_t bom;
+		uint32_t sections;
+		uint64_t hash;
+		uint32_t symbols;
+		uint32_t reloc_sets;
+		uint32_t relocs;
+		uint32_t strings_size;
+		uint64_t data_size;
+	};
+
+	struct cache_section {
+		uint32_t name;
+		uint32_t name_size;
+		uint32_t type;
+		uint32_t align;
+		uint32_t size;
+		uint32_t data_size;
+		uint64_t data; // offset from the start of the section data
+	};
+
+	struct cache_symbol {
+		uint32_t name;
+		uint32_t name_size;
+		uint32_t value;
+		uint16_t shndx;
+		uint8_t bind;
+		uint8_t named;
+	};
+
+	struct cache_relocs {
+		uint32_t section;
+		uint32_t first;
+		uint32_t count;
+		uint32_t reserved;
+	};
+
+	static_assert(sizeof(header) % 8 == 0, "Invalid size for header");
+	static_assert(sizeof(cache_section) % 8 == 0, "Invalid size for cache_section");
+	static_assert(sizeof(cache_symbol) == 16, "Invalid size for cache_symbol");
+	static_assert(sizeof(cache_relocs) == 16, "Invalid size for cache_relocs");
+	static_assert(sizeof(Elf32_Rela) == 12, "Invalid size for Elf32_Rela");
+
+	void version_string(char (&out)[16]) {
+		memset(out, 0, sizeof(out));
+		strncpy(out, ELF2OMF_VERSION, sizeof(out) - 1);
+	}
+}
+
+
+/*
+ * xxh64.  Fast enough that hashing an object costs far less than reading it.
+ */
+static const uint64_t P1 = 11400714785074694791ULL;
+static const uint64_t P2 = 14029467366897019727ULL;
+static const uint64_t P3 = 1609587929392839161ULL;
+static const uint64_t P4 = 9650029242287828579ULL;
+static const uint64_t P5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t read64(const uint8_t *p) { uint64_t x; memcpy(&x, p, 8); return x; }
+static inline uint32_t read32(const uint8_t *p) { uint32_t x; memcpy(&x, p, 4); return x; }
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+	acc += input * P2;
+	acc = rotl(acc, 31);
+	return acc * P1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+	acc ^= xxh_round(0, val);
+	return acc * P1 + P4;
+}
+
+uint64_t object_cache::hash(const uint8_t *p, size_t size) {
+
+	const uint8_t *end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v1 = P1 + P2;
+		uint64_t v2 = P2;
+		uint64_t v3 = 0;
+		uint64_t v4 = -P1;
+		const uint8_t *limit = end - 32;
+		do {
+			v1 = xxh_round(v1, read64(p)); p += 8;
+			v2 = xxh_round(v2, read64(p)); p += 8;
+			v3 = xxh_round(v3, read64(p)); p += 8;
+			v4 = xxh_round(v4, read64(p)); p += 8;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	} else {
+		h = P5;
+	}
+
+	h += size;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh_round(0, read64(p));
+		h = rotl(h, 27) * P1 + P4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * P1;
+		h = rotl(h, 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= *p * P5;
+		h = rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+std::shared_ptr<uint8_t> object_cache::map(int fd, size_t &size) {
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) return nullptr;
+
+	size = st.st_size;
+	void *vp = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (vp == MAP_FAILED) return nullptr;
+
+	size_t tmp = size;
+	return std::shared_ptr<uint8_t>((uint8_t *)vp, [tmp](uint8_t *p){ munmap(p, tmp); });
+}
+
+
+static const char entry_suffix[] = "-" ELF2OMF_VERSION ".objc";
+static const char output_suffix[] = "-" ELF2OMF_VERSION ".omf";
+
+static std::string entry_name(const std::string &dir, uint64_t hash, const char *suffix = entry_suffix) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+	return dir + buffer + suffix;
+}
+
+
+object_cache::object_cache(const std::string &dir) : _dir(dir) {
+	if (!_dir.empty() && _dir.back() != '/') _dir.push_back('/');
+	if (mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST)
+		throw std::system_error(errno, std::generic_category(), dir);
+
+	DIR *dp = opendir(dir.c_str());
+	if (!dp) throw std::system_error(errno, std::generic_category(), dir);
+
+	size_t suffix = sizeof(entry_suffix) - 1;
+	while (struct dirent *d = readdir(dp)) {
+		std::string_view name(d->d_name);
+		if (name.size() != 16 + suffix || name.substr(16) != entry_suffix) continue;
+
+		char *end = nullptr;
+		std::string tmp(name.substr(0, 16));
+		uint64_t hash = strtoull(tmp.c_str(), &end, 16);
+		if (*end == 0) _entries.insert(hash);
+	}
+	closedir(dp);
+}
+
+
+// writev with the usual short write handling.
+static bool write_all(int fd, std::vector<iovec> &iov) {
+	size_t i = 0;
+	while (i < iov.size()) {
+		size_t count = std::min<size_t>(iov.size() - i, IOV_MAX);
+		ssize_t n = writev(fd, iov.data() + i, count);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		// advance past what was written.
+		while (n > 0 && i < iov.size()) {
+			if ((size_t)n >= iov[i].iov_len) {
+				n -= iov[i].iov_len;
+				++i;
+			} else {
+				iov[i].iov_base = (uint8_t *)iov[i].iov_base + n;
+				iov[i].iov_len -= n;
+				n = 0;
+			}
+		}
+		while (i < iov.size() && iov[i].iov_len == 0) ++i;
+	}
+	return true;
+}
+
+// write an entry to a temporary file, then rename it into place.
+static void write_entry(const std::string &path, std::vector<iovec> &iov) {
+	std::string tmp = path + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if (fd < 0) return;
+
+	bool ok = write_all(fd, iov);
+	if (close(fd) < 0) ok = false;
+
+	if (!ok || rename(tmp.c_str(), path.c_str()) < 0) unlink(tmp.c_str());
+}
+
+
+std::shared_ptr<void> object_cache::load(uint64_t hash,
+	std::vector<input_section> &sections,
+	std::vector<input_symbol> &symbols,
+	std::vector<input_relocs> &relocs) const {
+
+	if (!_entries.count(hash)) return nullptr;
+
+	std::string path = entry_name(_dir, hash);
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	size_t size = 0;
+	auto map = object_cache::map(fd, size);
+	if (map) futimens(fd, nullptr); // mark as recently used
+	close(fd);
+	if (!map) return nullptr;
+
+	const uint8_t *base = map.get();
+	if (size < sizeof(header)) return nullptr;
+
+	const header &h = *(const header *)base;
+	char version[16];
+	version_string(version);
+
+	if (memcmp(h.magic, cache_magic, sizeof(cache_magic))) return nullptr;
+	if (memcmp(h.version, version, sizeof(version))) return nullptr;
+	if (h.bom != cache_bom || h.hash != hash) return nullptr;
+
+	uint64_t offset = sizeof(header);
+	uint64_t expected = offset
+		+ (uint64_t)h.sections * sizeof(cache_section)
+		+ (uint64_t)h.symbols * sizeof(cache_symbol)
+		+ (uint64_t)h.reloc_sets * sizeof(cache_relocs)
+		+ (uint64_t)h.relocs * sizeof(Elf32_Rela)
+		+ h.strings_size
+		+ h.data_size;
+	if (expected != size) return nullptr;
+
+	const cache_section *cs = (const cache_section *)(base + offset);
+	offset += (uint64_t)h.sections * sizeof(cache_section);
+	const cache_symbol *csym = (const cache_symbol *)(base + offset);
+	offset += (uint64_t)h.symbols * sizeof(cache_symbol);
+	const cache_relocs *cr = (const cache_relocs *)(base + offset);
+	offset += (uint64_t)h.reloc_sets * sizeof(cache_relocs);
+	const Elf32_Rela *rela = (const Elf32_Rela *)(base + offset);
+	offset += (uint64_t)h.relocs * sizeof(Elf32_Rela);
+	const char *strings = (const char *)(base + offset);
+	offset += h.strings_size;
+	const uint8_t *data = base + offset;
+
+	auto string = [&](uint32_t name, uint32_t name_size, std::string_view &out) {
+		if (name > h.strings_size || name_size > h.strings_size - name) return false;
+		out = std::string_view(strings + name, name_size);
+		return true;
+	};
+
+	sections.resize(h.sections);
+	for (uint32_t i = 0; i < h.sections; ++i) {
+		const auto &x = cs[i];
+		auto &s = sections[i];
+		if (!string(x.name, x.name_size, s.name)) return nullptr;
+		if (x.data > h.data_size || x.data_size > h.data_size - x.data) return nullptr;
+		s.type = x.type;
+		s.align = x.align;
+		s.size = x.size;
+		s.data = view<uint8_t>(data + x.data, x.data_size);
+	}
+
+	symbols.resize(h.symbols);
+	for (uint32_t i = 0; i < h.symbols; ++i) {
+		const auto &x = csym[i];
+		auto &sym = symbols[i];
+		if (!string(x.name, x.name_size, sym.name)) return nullptr;
+		sym.named = x.named;
+		sym.bind = x.bind;
+		sym.shndx = x.shndx;
+		sym.value = x.value;
+	}
+
+	relocs.resize(h.reloc_sets);
+	for (uint32_t i = 0; i < h.reloc_sets; ++i) {
+		const auto &x = cr[i];
+		if (x.section >= h.sections) return nullptr;
+		if (x.first > h.relocs || x.count > h.relocs - x.first) return nullptr;
+		relocs[i].section = x.section;
+		relocs[i].relocs = reloc_cursor(rela + x.first, x.count);
+	}
+
+	return map;
+}
+
+
+void object_cache::store(uint64_t hash,
+	const std::vector<input_section> &sections,
+	const std::vector<input_symbol> &symbols,
+	const std::vector<input_relocs> &relocs) const {
+
+	std::string strings;
+	uint64_t data_size = 0;
+
+	auto add_string = [&](std::string_view s, uint32_t &name, uint32_t &name_size) {
+		name = strings.size();
+		name_size = s.size();
+		strings.append(s);
+	};
+
+	std::vector<cache_section> cs(sections.size());
+	for (size_t i = 0; i < sections.size(); ++i) {
+		const auto &s = sections[i];
+		auto &x = cs[i];
+		add_string(s.name, x.name, x.name_size);
+		x.type = s.type;
+		x.align = s.align;
+		x.size = s.size;
+		x.data = data_size;
+		x.data_size = s.type ? s.data.size() : 0; // unmerged sections aren't needed
+		data_size += x.data_size;
+	}
+
+	std::vector<cache_symbol> csym(symbols.size());
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		const auto &sym = symbols[i];
+		auto &x = csym[i];
+		add_string(sym.name, x.name, x.name_size);
+		x.value = sym.value;
+		x.shndx = sym.shndx;
+		x.bind = sym.bind;
+		x.named = sym.named;
+	}
+
+	std::vector<cache_relocs> cr(relocs.size());
+	std::vector<Elf32_Rela> rela;
+	for (size_t i = 0; i < relocs.size(); ++i) {
+		const auto &ir = relocs[i];
+		auto &x = cr[i];
+		x.section = ir.section;
+		x.first = rela.size();
+		x.count = ir.relocs.size();
+		for (size_t j = 0; j < ir.relocs.size(); ++j)
+			rela.push_back(ir.relocs[j]);
+	}
+
+	// keep the section data 4-byte aligned.
+	strings.resize((strings.size() + 3) & ~3);
+	if (strings.size() > UINT32_MAX || rela.size() > UINT32_MAX) return;
+
+	header h = {};
+	memcpy(h.magic, cache_magic, sizeof(h.magic));
+	version_string(h.version);
+	h.bom = cache_bom;
+	h.hash = hash;
+	h.sections = cs.size();
+	h.symbols = csym.size();
+	h.reloc_sets = cr.size();
+	h.relocs = rela.size();
+	h.strings_size = strings.size();
+	h.data_size = data_size;
+
+	std::vector<iovec> iov;
+	auto push = [&](const void *p, size_t n) {
+		if (n) iov.push_back(iovec{ (void *)p, n });
+	};
+	push(&h, sizeof(h));
+	push(cs.data(), cs.size() * sizeof(cache_section));
+	push(csym.data(), csym.size() * sizeof(cache_symbol));
+	push(cr.data(), cr.size() * sizeof(cache_relocs));
+	push(rela.data(), rela.size() * sizeof(Elf32_Rela));
+	push(strings.data(), strings.size());
+	for (size_t i = 0; i < sections.size(); ++i) push(sections[i].data.data(), cs[i].data_size);
+
+	write_entry(entry_name(_dir, hash), iov);
+}
+
+
+bool object_cache::load_output(uint64_t key, const std::string &path) const {
+
+	int fd = open(entry_name(_dir, key, output_suffix).c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	size_t size = 0;
+	auto map = object_cache::map(fd, size);
+	if (map) futimens(fd, nullptr);
+	close(fd);
+	if (!map) return false;
+
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) return false;
+
+	std::vector<iovec> iov = { iovec{ map.get(), size } };
+	bool ok = write_all(fd, iov);
+	if (close(fd) < 0) ok = false;
+	if (!ok) unlink(path.c_str());
+	return ok;
+}
+
+void object_cache::store_output(uint64_t key, const std::string &path) const {
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return;
+
+	size_t size = 0;
+	auto map = object_cache::map(fd, size);
+	close(fd);
+	if (!map) return;
+
+	std::vector<iovec> iov = { iovec{ map.get(), size } };
+	write_entry(entry_name(_dir, key, output_suffix), iov);
+}
+
+
+void object_cache::evict(uint64_t max_size, unsigned max_days) const {
+
+	if (!max_size && !max_days) return;
+
+	struct entry {
+		std::string name;
+		uint64_t size;
+		time_t mtime;
+	};
+	std::vector<entry> entries;
+	uint64_t total = 0;
+
+	DIR *dp = opendir(_dir.c_str());
+	if (!dp) return;
+
+	// every version's entries count, so old versions age out.
+	while (struct dirent *d = readdir(dp)) {
+		std::string_view name(d->d_name);
+		bool ours = (name.size() > 5 && name.substr(name.size() - 5) == ".objc")
+			|| (name.size() > 4 && name.substr(name.size() - 4) == ".omf");
+		if (!ours) continue;
+
+		struct stat st;
+		std::string path = _dir + d->d_name;
+		if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) continue;
+		entries.push_back(entry{ std::move(path), (uint64_t)st.st_size, st.st_mtime });
+		total += st.st_size;
+	}
+	closedir(dp);
+
+	std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b){
+		return a.mtime < b.mtime;
+	});
+
+	time_t cutoff = max_days ? time(nullptr) - (time_t)max_days * 24 * 60 * 60 : 0;
+	for (const auto &e : entries) {
+		bool old = max_days && e.mtime < cutoff;
+		bool over = max_size && total > max_size;
+		if (!old && !over) break;
+		if (unlink(e.name.c_str()) == 0) total -= e.size;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef __object_cache_h__
+#define __object_cache_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "input.h"
+
+/*
+ * On-disk cache of parsed objects, keyed by a hash of the object's
+ * contents and the elf2omf version.  An entry holds the decoded sections,
+ * symbols and relocations (plus the section data) in native byte order
+ * and is loaded with a single mmap; the input_* views point into it.
+ *
+ * The same directory holds whole-link outputs.  Entries are written to a
+ * temporary file and renamed so concurrent links can share a cache
+ * directory.  An entry's mtime is updated when it's used, for eviction.
+ */
+class object_cache {
+
+	std::string _dir;
+	std::unordered_set<uint64_t> _entries; // listed once, saving a failed open per miss
+
+public:
+
+	std::atomic<unsigned> hits{0};
+	std::atomic<unsigned> misses{0};
+
+	// the directory is created if necessary.
+	explicit object_cache(const std::string &dir);
+
+	object_cache(const object_cache &) = delete;
+	object_cache &operator=(const object_cache &) = delete;
+
+	static uint64_t hash(const uint8_t *data, size_t size);
+
+	// map a regular file read-only.  Returns nullptr if it can't be mapped.
+	static std::shared_ptr<uint8_t> map(int fd, size_t &size);
+
+	// returns the mapping (which must be kept alive as long as the views
+	// are used) or nullptr if there is no valid entry.
+	std::shared_ptr<void> load(uint64_t hash,
+		std::vector<input_section> &sections,
+		std::vector<input_symbol> &symbols,
+		std::vector<input_relocs> &relocs) const;
+
+	// best effort; failures are silently ignored.
+	void store(uint64_t hash,
+		const std::vector<input_section> &sections,
+		const std::vector<input_symbol> &symbols,
+		const std::vector<input_relocs> &relocs) const;
+
+	// whole-link outputs, keyed by a hash of all the inputs and options.
+	// load_output copies the cached output to path and returns true on a hit.
+	bool load_output(uint64_t key, const std::string &path) const;
+	void store_output(uint64_t key, const std::string &path) const;
+
+	// remove entries not used in max_days (0 = no limit), then the least
+	// recently used entries until the cache is under max_size (0 = no limit).
+	void evict(uint64_t max_size, unsigned max_days) const;
+};
+
+#endif
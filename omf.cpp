@@ -1,4 +1,5 @@
 #include "omf.h"
+#include "worker_pool.h"
 
 #include <vector>
 #include <string>
@@ -7,11 +8,16 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
 #include <err.h>
 #include <sysexits.h>
 #include <assert.h>
 
+#include <cstring>
 #include <optional>
+#include <system_error>
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -287,7 +293,8 @@ enum {
 	SUPER_INTERSEG36,
 };
 
-uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment &seg, bool compress, bool super) {
+// append relocation records to data.  SUPER records patch the segment data in place.
+uint32_t add_relocs(std::vector<uint8_t> &data, omf::segment &seg, bool compress, bool super) {
 
 	std::array<std::optional<super_helper>, 38 > ss;
 
@@ -308,7 +315,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.value;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						seg.data[r.offset + i] = value; 
 					continue;
 				}
 
@@ -324,7 +331,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.value;
 					for (int i = 0; i < 3; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						seg.data[r.offset + i] = value; 
 					continue;	
 				}
 
@@ -338,7 +345,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.value;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						seg.data[r.offset + i] = value; 
 					continue;
 				}
 			}
@@ -372,9 +379,9 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.segment_offset;
 
-					data[data_offset + r.offset + 0] = value; value >>= 8;
-					data[data_offset + r.offset + 1] = value; value >>= 8;
-					data[data_offset + r.offset + 2] = r.segment;
+					seg.data[r.offset + 0] = value; value >>= 8;
+					seg.data[r.offset + 1] = value; value >>= 8;
+					seg.data[r.offset + 2] = r.segment;
 					continue;
 				}
 
@@ -388,7 +395,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.segment_offset;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						seg.data[r.offset + i] = value; 
 					continue;
 				}
 
@@ -401,7 +408,7 @@ uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment
 
 					uint32_t value = r.segment_offset;
 					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
+						seg.data[r.offset + i] = value; 
 					continue;
 				}
 			}
@@ -477,7 +484,75 @@ void save_bin(const std::string &path, omf::segment &segment, uint32_t org) {
 }
 
 
-void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags) {
+static const uint8_t zero_page[4096] = {};
+
+// writev(), looping on short writes.
+static size_t write_all(int fd, std::vector<iovec> &iov) {
+
+	size_t total = 0;
+	size_t i = 0;
+	while (i < iov.size()) {
+		int count = std::min(iov.size() - i, (size_t)IOV_MAX);
+		ssize_t ok = writev(fd, iov.data() + i, count);
+		if (ok < 0) {
+			if (errno == EINTR) continue;
+			throw std::system_error(errno, std::generic_category(), "write");
+		}
+		total += ok;
+		while (i < iov.size() && ok >= (ssize_t)iov[i].iov_len) {
+			ok -= iov[i].iov_len;
+			++i;
+		}
+		if (ok) {
+			iov[i].iov_base = (uint8_t *)iov[i].iov_base + ok;
+			iov[i].iov_len -= ok;
+		}
+	}
+	return total;
+}
+
+// where the omf file goes: a file or memory.  Writes are at the current
+// position.
+class omf_writer {
+
+	int _fd = -1;
+	std::vector<uint8_t> *_image = nullptr;
+	size_t _offset = 0;
+
+public:
+
+	explicit omf_writer(int fd) : _fd(fd) {}
+	explicit omf_writer(std::vector<uint8_t> &image) : _image(&image) {}
+
+	void seek(size_t offset) {
+		_offset = offset;
+		if (_fd >= 0) lseek(_fd, offset, SEEK_SET);
+	}
+
+	size_t write(std::vector<iovec> &iov) {
+		if (_fd >= 0) {
+			size_t n = write_all(_fd, iov);
+			_offset += n;
+			return n;
+		}
+
+		size_t total = 0;
+		for (const auto &v : iov) total += v.iov_len;
+		if (_image->size() < _offset + total) _image->resize(_offset + total);
+		for (const auto &v : iov) {
+			if (v.iov_len) memcpy(_image->data() + _offset, v.iov_base, v.iov_len);
+			_offset += v.iov_len;
+		}
+		return total;
+	}
+
+	size_t write(const void *data, size_t size) {
+		std::vector<iovec> iov = { { const_cast<void *>(data), size } };
+		return write(iov);
+	}
+};
+
+static void write_omf(omf_writer &out, std::vector<omf::segment> &segments, unsigned flags, unsigned jobs) {
 
 	// expressload doesn't support links to other files. 
 	// fortunately, we don't either.
@@ -496,13 +571,6 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		super = false;
 	}
 
-	int fd;
-	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
-	if (fd < 0) {
-		err(EX_CANTCREAT, "Unable to open %s", path.c_str());
-	}
-
-
 	uint32_t offset = 0;
 	if (expressload) {
 		for (auto &s : segments) {
@@ -522,11 +590,28 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 			offset += s.segname.length() + 1;
 		}
 
-		lseek(fd, offset, SEEK_SET);
+		out.seek(offset);
 	}
 
+	// the relocation records don't depend on the file layout, so the
+	// segments are encoded up front, in parallel, and laid out after.
+	struct encoded_segment {
+		std::vector<uint8_t> tail;
+		uint32_t reloc_size = 0;
+	};
+	std::vector<encoded_segment> encoded(segments.size());
+
+	parallel_for(jobs, segments.size(), [&](size_t i){
+		auto &e = encoded[i];
+		e.reloc_size = add_relocs(e.tail, segments[i], compress, super);
 
-	for (auto &s : segments) {
+		// end-of-record
+		push(e.tail, (uint8_t)omf::END);
+	});
+
+
+	for (size_t i = 0; i < segments.size(); ++i) {
+		auto &s = segments[i];
 		omf_header h;
 		h.length = s.data.size() + s.reserved_space;
 		h.kind = s.kind;
@@ -563,24 +648,18 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		//lconst record
 		push(data, (uint8_t)omf::LCONST);
 		push(data, (uint32_t)lconst_size);
+		s.data_offset = offset + sizeof(omf_header) + data.size();
 
-		size_t data_offset = data.size();
+		// the segment data is written directly from s.data rather than
+		// copied into the record buffer.
+		size_t body_size = data.size() + s.data.size() + reserved_space;
 
-		data.insert(data.end(), s.data.begin(), s.data.end());
+		const auto &tail = encoded[i].tail;
 
-		if (reserved_space) {
-			data.insert(data.end(), reserved_space, 0);
-		}
-
-		uint32_t reloc_offset = offset + sizeof(omf_header) + data.size();
-		uint32_t reloc_size = 0;
+		uint32_t reloc_offset = offset + sizeof(omf_header) + body_size;
+		uint32_t reloc_size = encoded[i].reloc_size;
 
-		reloc_size = add_relocs(data, data_offset, s, compress, super);
-
-		// end-of-record
-		push(data, (uint8_t)omf::END);
-
-		h.bytecount = data.size() + sizeof(omf_header);
+		h.bytecount = body_size + tail.size() + sizeof(omf_header);
 
 		if (expressload) {
 
@@ -618,13 +697,23 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		if (v1) to_v1(h);
 		to_little(h);
 
-		offset += write(fd, &h, sizeof(h));
-		offset += write(fd, data.data(), data.size());
+		std::vector<iovec> iov;
+		iov.push_back({ &h, sizeof(h) });
+		iov.push_back({ data.data(), data.size() });
+		if (!s.data.empty()) iov.push_back({ s.data.data(), s.data.size() });
+		for (uint32_t n = reserved_space; n; ) {
+			uint32_t count = std::min(n, (uint32_t)sizeof(zero_page));
+			iov.push_back({ (void *)zero_page, count });
+			n -= count;
+		}
+		iov.push_back({ const_cast<uint8_t *>(tail.data()), tail.size() });
+
+		offset += out.write(iov);
 
 		// version 1 needs 512-byte padding for all but final segment.
 		if (v1 && &s != &segments.back()) {
 			static uint8_t zero[512];
-			offset += write(fd, zero, 512 - (offset & 511) );
+			offset += out.write(zero, 512 - (offset & 511));
 		}
 	}
 
@@ -667,11 +756,23 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		h.bytecount = data.size() + sizeof(omf_header);
 
 		to_little(h);
-		lseek(fd, 0, SEEK_SET);
-		write(fd, &h, sizeof(h));
-		write(fd, data.data(), data.size());
+		out.seek(0);
+		out.write(&h, sizeof(h));
+		out.write(data.data(), data.size());
 
 	}
+}
 
-	close(fd);
+void save_omf(int fd, std::vector<omf::segment> &segments, unsigned flags, unsigned jobs) {
+
+	omf_writer out(fd);
+	write_omf(out, segments, flags, jobs);
+}
+
+std::vector<uint8_t> omf_image(std::vector<omf::segment> &segments, unsigned flags, unsigned jobs) {
+
+	std::vector<uint8_t> image;
+	omf_writer out(image);
+	write_omf(out, segments, flags, jobs);
+	return image;
 }
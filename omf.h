@@ -68,6 +68,7 @@ namespace omf {
 		uint32_t alignment = 0;
 		uint32_t reserved_space = 0;
 		uint32_t org = 0;
+		uint32_t data_offset = 0; // file offset of the LCONST data, set by save_omf
 
 		std::string loadname;
 		std::string segname;
@@ -90,7 +91,11 @@ enum {
 
 };
 
-void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags);
+// write to fd, a newly created file (which isn't closed), or to memory.
+// These throw std::system_error on failure.  Segments are encoded on up to
+// jobs threads.
+void save_omf(int fd, std::vector<omf::segment> &segments, unsigned flags, unsigned jobs = 1);
+std::vector<uint8_t> omf_image(std::vector<omf::segment> &segments, unsigned flags, unsigned jobs = 1);
 
 
 #endif
@@ -0,0 +1,748 @@
+#include "omf_input.h"
+#include "elf_file.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+	[[noreturn]] void throw_omf_error(const std::string &msg = "invalid omf file") {
+		throw std::runtime_error(msg);
+	}
+
+	uint32_t read16(const uint8_t *p) {
+		return p[0] | (p[1] << 8);
+	}
+
+	uint32_t read32(const uint8_t *p) {
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	enum {
+		KIND_CODE = 0x00,
+		KIND_DATA = 0x01,
+		KIND_DICTIONARY = 0x08,
+		KIND_DP_STACK = 0x12,
+		KIND_PRIVATE = 0x4000,
+	};
+
+	// the parts of a segment header we use.
+	struct segment_header {
+		uint32_t size = 0; // including the header
+		uint32_t resspc = 0;
+		unsigned lablen = 0;
+		unsigned numlen = 0;
+		unsigned version = 0;
+		unsigned kind = 0;
+		uint32_t align = 0;
+		uint32_t body = 0; // offset of the first record
+	};
+
+	// segment at data, with size bytes left in the file.  Version 1 and 2
+	// headers are the same apart from the size and kind.
+	bool read_header(const uint8_t *data, size_t size, segment_header &h) {
+
+		if (size < 0x30) return false;
+
+		h.version = data[0x0f];
+		if (h.version != 1 && h.version != 2) return false;
+
+		h.size = read32(data);
+		if (h.version == 1) {
+			if (h.size > size / 512 + 1) return false;
+			h.size = std::min<size_t>(h.size * 512, size);
+			unsigned k = data[0x0c];
+			h.kind = (k & 0x1f) | (k & 0xe0) << 8;
+		} else {
+			h.kind = read16(data + 0x14);
+		}
+		if (h.size < 0x30 || h.size > size) return false;
+
+		h.resspc = read32(data + 0x04);
+		h.lablen = data[0x0d];
+		h.numlen = data[0x0e];
+		h.align = read32(data + 0x1c);
+		h.body = read16(data + 0x2a);
+
+		if (h.numlen != 4) return false;
+		if (data[0x20] != 0) return false; // big-endian numbers
+		if (h.body < 0x30 || h.body > h.size) return false;
+		return true;
+	}
+
+
+	// reads a segment's records, in order.
+	class record_reader {
+
+		const uint8_t *_p = nullptr;
+		const uint8_t *_end = nullptr;
+		unsigned _lablen = 0;
+		unsigned _numlen = 4;
+
+		void need(size_t n) const {
+			if ((size_t)(_end - _p) < n) throw_omf_error("truncated omf segment");
+		}
+
+	public:
+
+		record_reader(const uint8_t *p, const uint8_t *end, const segment_header &h) :
+			_p(p), _end(end), _lablen(h.lablen), _numlen(h.numlen)
+		{}
+
+		bool at_end() const { return _p >= _end; }
+		const uint8_t *position() const { return _p; }
+
+		uint8_t byte() {
+			need(1);
+			return *_p++;
+		}
+
+		uint32_t word() {
+			need(2);
+			uint32_t x = read16(_p);
+			_p += 2;
+			return x;
+		}
+
+		uint32_t number() {
+			need(_numlen);
+			uint32_t x = read32(_p);
+			_p += _numlen;
+			return x;
+		}
+
+		const uint8_t *bytes(size_t n) {
+			need(n);
+			const uint8_t *p = _p;
+			_p += n;
+			return p;
+		}
+
+		std::string label() {
+			size_t n = _lablen ? _lablen : byte();
+			const char *cp = (const char *)bytes(n);
+			while (_lablen && n && cp[n - 1] == ' ') --n; // fixed length labels are space padded
+			return std::string(cp, n);
+		}
+
+		// skip an expression, returning its size.
+		size_t skip_expression() {
+			const uint8_t *start = _p;
+			for(;;) {
+				uint8_t op = byte();
+				if (op == 0x00) break;
+				if (op == 0x81 || op == 0x87) number();
+				else if (op >= 0x82 && op <= 0x86) label();
+			}
+			return _p - start;
+		}
+	};
+
+
+	// a value while evaluating an expression: a symbol (or none) plus a
+	// constant, possibly shifted right.
+	struct term {
+		int sym = 0;
+		int64_t value = 0;
+		unsigned shift = 0;
+	};
+
+	struct label_def {
+		std::string name;
+		unsigned segment = 0;
+		uint32_t offset = 0;
+		bool global = false;
+		bool equ = false;
+		const uint8_t *expr = nullptr;
+		size_t expr_size = 0;
+	};
+
+	// an expression to be stored in the segment data.
+	struct fixup {
+		unsigned segment = 0;
+		uint32_t offset = 0;
+		unsigned size = 0;
+		bool relative = false;
+		uint32_t origin = 0;
+		const uint8_t *expr = nullptr;
+		size_t expr_size = 0;
+	};
+
+	class omf_decoder {
+
+		std::shared_ptr<omf_object> _obj;
+		std::vector<segment_header> _headers;
+		std::vector<label_def> _labels;
+		std::vector<fixup> _fixups;
+
+		// name lookup: labels local to a segment, then labels in the
+		// file (including private ones), then external symbols.
+		std::vector<std::unordered_map<std::string, int>> _locals;
+		std::unordered_map<std::string, int> _globals;
+		std::unordered_map<std::string, int> _externals;
+
+		void read_segment(const uint8_t *data, const segment_header &h);
+		void define_labels();
+		int resolve(const std::string &name, unsigned segment);
+		term evaluate(const uint8_t *expr, size_t size, unsigned segment, uint32_t pc);
+		void apply(const fixup &f);
+
+		input_symbol &symbol(int sym) { return _obj->symbols[sym]; }
+		bool in_segment(int sym) {
+			auto shndx = symbol(sym).shndx;
+			return shndx && shndx < _obj->sections.size();
+		}
+
+	public:
+
+		std::shared_ptr<omf_object> decode(const uint8_t *data, size_t size);
+	};
+
+
+	void omf_decoder::read_segment(const uint8_t *data, const segment_header &h) {
+
+		unsigned segment = _obj->sections.size();
+		auto &out = _obj->data.emplace_back();
+		auto &is = _obj->sections.emplace_back();
+		_locals.emplace_back();
+
+		unsigned type = h.kind & 0x1f;
+		switch (type) {
+			case KIND_CODE: is.name = "code"; is.type = TYPE_CODE; break;
+			case KIND_DATA: is.name = "data"; is.type = TYPE_DATA; break;
+			case KIND_DP_STACK: is.name = "stack"; is.type = TYPE_BSS; break;
+			case KIND_DICTIONARY: throw_omf_error("omf library dictionary in an object file");
+			default: throw_omf_error("unsupported omf segment kind");
+		}
+		is.align = h.align > 1 ? h.align : 0;
+
+		bool private_segment = h.kind & KIND_PRIVATE;
+		size_t fixups = _fixups.size();
+
+		record_reader in(data + h.body, data + h.size, h);
+		auto define = [&](bool global, bool equ){
+			auto &l = _labels.emplace_back();
+			l.name = in.label();
+			if (h.version == 1) in.byte(); else in.word(); // length attribute
+			in.byte(); // type attribute
+			bool private_label = in.byte();
+			l.segment = segment;
+			l.offset = out.size();
+			l.global = global && !private_label && !private_segment;
+			l.equ = equ;
+			if (equ) {
+				l.expr = in.position();
+				l.expr_size = in.skip_expression();
+			}
+			// private globals are still visible to the rest of the file.
+			auto &scope = global ? _globals : _locals[segment];
+			if (!scope.emplace(l.name, -(int)_labels.size()).second)
+				throw_omf_error("duplicate label " + l.name);
+		};
+		auto expression = [&](unsigned size, bool relative){
+			auto &f = _fixups.emplace_back();
+			f.segment = segment;
+			f.offset = out.size();
+			f.size = size;
+			f.relative = relative;
+			if (relative) f.origin = in.number();
+			f.expr = in.position();
+			f.expr_size = in.skip_expression();
+			out.resize(out.size() + size);
+		};
+
+		while (!in.at_end()) {
+			uint8_t op = in.byte();
+			if (op == 0x00) break;
+
+			if (op <= 0xdf) {
+				const uint8_t *p = in.bytes(op);
+				out.insert(out.end(), p, p + op);
+				continue;
+			}
+
+			switch (op) {
+				case 0xf2: { // LCONST
+					uint32_t n = in.number();
+					const uint8_t *p = in.bytes(n);
+					out.insert(out.end(), p, p + n);
+					break;
+				}
+				case 0xf1: // DS
+					out.resize(out.size() + in.number());
+					break;
+				case 0xe0: { // ALIGN
+					uint32_t n = in.number();
+					if (n & (n - 1)) throw_omf_error("bad omf alignment");
+					if (n > 1) {
+						out.resize((out.size() + n - 1) & ~(size_t)(n - 1));
+						is.align = std::max(is.align, n);
+					}
+					break;
+				}
+				case 0xe6: define(true, false); break; // GLOBAL
+				case 0xef: define(false, false); break; // LOCAL
+				case 0xe7: define(true, true); break; // GEQU
+				case 0xf0: define(false, true); break; // EQU
+
+				case 0xeb: // EXPR
+				case 0xec: // ZEXPR
+				case 0xed: // BEXPR
+				case 0xf3: // LEXPR
+					expression(in.byte(), false);
+					break;
+				case 0xee: // RELEXPR
+					expression(in.byte(), true);
+					break;
+
+				case 0xe4: // USING
+				case 0xe5: // STRONG
+					in.label();
+					break;
+				case 0xf4: // ENTRY
+					in.word();
+					in.number();
+					in.label();
+					break;
+
+				case 0xe1: throw_omf_error("omf ORG records are not supported");
+				case 0xe8: throw_omf_error("omf MEM records are not supported");
+				case 0xe2: case 0xe3: case 0xf5: case 0xf6: case 0xf7:
+					throw_omf_error("omf load file, not an object file");
+				default:
+					throw_omf_error("bad omf record");
+			}
+		}
+
+		out.resize(out.size() + h.resspc);
+
+		// an uninitialized data segment is bss.
+		if (is.type == TYPE_DATA && fixups == _fixups.size()
+			&& std::all_of(out.begin(), out.end(), [](uint8_t x){ return x == 0; })) {
+			is.name = "zdata";
+			is.type = TYPE_BSS;
+		}
+		if (is.type == TYPE_BSS) {
+			if (fixups != _fixups.size() || !std::all_of(out.begin(), out.end(), [](uint8_t x){ return x == 0; }))
+				throw_omf_error("omf dp/stack segment has data");
+			is.size = out.size();
+			out.clear();
+		} else {
+			is.size = out.size();
+		}
+	}
+
+	// the segments' (section) symbols and the labels, in order.
+	void omf_decoder::define_labels() {
+
+		auto &symbols = _obj->symbols;
+		symbols.resize(_obj->sections.size() + _labels.size());
+
+		for (unsigned i = 1; i < _obj->sections.size(); ++i) {
+			auto &sym = symbols[i];
+			sym.bind = STB_LOCAL;
+			sym.shndx = i;
+		}
+
+		std::vector<int> ids(_labels.size());
+		unsigned base = _obj->sections.size();
+		for (size_t i = 0; i < _labels.size(); ++i) {
+			const auto &l = _labels[i];
+			auto &sym = symbols[base + i];
+			sym.name = _obj->names.emplace_back(l.name);
+			sym.named = true;
+			sym.bind = l.global ? STB_GLOBAL : STB_LOCAL;
+			if (!l.equ) {
+				sym.shndx = l.segment;
+				sym.value = l.offset;
+			}
+		}
+
+		// the scopes hold -(label number + 1) until now.
+		auto fix = [&](std::unordered_map<std::string, int> &scope){
+			for (auto &kv : scope) kv.second = base - kv.second - 1;
+		};
+		fix(_globals);
+		for (auto &scope : _locals) fix(scope);
+
+		// equates, in order; they can only use labels defined before them.
+		for (size_t i = 0; i < _labels.size(); ++i) {
+			const auto &l = _labels[i];
+			if (!l.equ) continue;
+
+			term t = evaluate(l.expr, l.expr_size, l.segment, l.offset);
+			auto &sym = symbols[base + i];
+			if (!t.sym) {
+				sym.shndx = SHN_ABS;
+				sym.value = t.value;
+			} else if (!t.shift && in_segment(t.sym)) {
+				sym.shndx = symbol(t.sym).shndx;
+				sym.value = symbol(t.sym).value + t.value;
+			} else {
+				throw_omf_error("unsupported omf equate: " + l.name);
+			}
+		}
+	}
+
+	int omf_decoder::resolve(const std::string &name, unsigned segment) {
+
+		auto iter = _locals[segment].find(name);
+		if (iter != _locals[segment].end()) return iter->second;
+
+		iter = _globals.find(name);
+		if (iter != _globals.end()) return iter->second;
+
+		iter = _externals.find(name);
+		if (iter != _externals.end()) return iter->second;
+
+		int sym = _obj->symbols.size();
+		auto &x = _obj->symbols.emplace_back();
+		x.name = _obj->names.emplace_back(name);
+		x.named = true;
+		x.bind = STB_GLOBAL;
+		_externals.emplace(name, sym);
+		return sym;
+	}
+
+	term omf_decoder::evaluate(const uint8_t *expr, size_t size, unsigned segment, uint32_t pc) {
+
+		record_reader in(expr, expr + size, _headers[segment - 1]);
+		std::vector<term> stack;
+
+		auto pop = [&](){
+			if (stack.empty()) throw_omf_error("bad omf expression");
+			term t = stack.back();
+			stack.pop_back();
+			return t;
+		};
+		auto constant = [&](const term &t){
+			if (t.sym || t.shift) throw_omf_error("unsupported omf expression");
+			return t.value;
+		};
+
+		for(;;) {
+			uint8_t op = in.byte();
+			if (op == 0x00) break;
+
+			term t;
+			switch (op) {
+				case 0x80: // location counter
+					t.sym = segment;
+					t.value = pc;
+					break;
+				case 0x81: // constant
+					t.value = (int32_t)in.number();
+					break;
+				case 0x82: // weak reference
+				case 0x83: { // label
+					t.sym = resolve(in.label(), segment);
+					const auto &x = symbol(t.sym);
+					if (x.shndx == SHN_ABS) {
+						t.sym = 0;
+						t.value = (int32_t)x.value;
+					}
+					break;
+				}
+				case 0x87: // offset in this segment
+					t.sym = segment;
+					t.value = in.number();
+					break;
+
+				case 0x06: t.value = -constant(pop()); break;
+				case 0x0b: t.value = !constant(pop()); break;
+				case 0x15: t.value = ~constant(pop()); break;
+
+				case 0x01: { // +
+					term b = pop();
+					t = pop();
+					if ((t.sym && b.sym) || t.shift || b.shift) throw_omf_error("unsupported omf expression");
+					if (b.sym) t.sym = b.sym;
+					t.value += b.value;
+					break;
+				}
+				case 0x02: { // -
+					term b = pop();
+					t = pop();
+					if (t.shift || b.shift) throw_omf_error("unsupported omf expression");
+					if (b.sym) {
+						// the distance between two labels in a segment.
+						if (!t.sym || !in_segment(t.sym) || !in_segment(b.sym)) throw_omf_error("unsupported omf expression");
+						if (symbol(t.sym).shndx != symbol(b.sym).shndx) throw_omf_error("unsupported omf expression");
+						t.value += symbol(t.sym).value;
+						b.value += symbol(b.sym).value;
+						t.sym = 0;
+					}
+					t.value -= b.value;
+					break;
+				}
+				case 0x07: { // shift (right if negative)
+					int64_t n = constant(pop());
+					t = pop();
+					if (t.sym) {
+						if (n > 0 || t.shift) throw_omf_error("unsupported omf expression");
+						t.shift = -n;
+					} else {
+						uint32_t x = t.value;
+						if (n <= -32 || n >= 32) x = 0;
+						else x = n >= 0 ? x << n : x >> -n;
+						t.value = x;
+					}
+					break;
+				}
+
+				case 0x03: case 0x04: case 0x05:
+				case 0x08: case 0x09: case 0x0a:
+				case 0x0c: case 0x0d: case 0x0e: case 0x0f: case 0x10: case 0x11:
+				case 0x12: case 0x13: case 0x14: {
+					int64_t b = constant(pop());
+					int64_t a = constant(pop());
+					switch (op) {
+						case 0x03: t.value = a * b; break;
+						case 0x04: if (!b) throw_omf_error("omf expression divides by zero"); t.value = a / b; break;
+						case 0x05: if (!b) throw_omf_error("omf expression divides by zero"); t.value = a % b; break;
+						case 0x08: t.value = a && b; break;
+						case 0x09: t.value = a || b; break;
+						case 0x0a: t.value = !a != !b; break;
+						case 0x0c: t.value = a <= b; break;
+						case 0x0d: t.value = a >= b; break;
+						case 0x0e: t.value = a != b; break;
+						case 0x0f: t.value = a < b; break;
+						case 0x10: t.value = a > b; break;
+						case 0x11: t.value = a == b; break;
+						case 0x12: t.value = a & b; break;
+						case 0x13: t.value = a | b; break;
+						case 0x14: t.value = a ^ b; break;
+					}
+					break;
+				}
+
+				default: // length, type and count attributes
+					throw_omf_error("unsupported omf expression");
+			}
+			stack.push_back(t);
+		}
+
+		term t = pop();
+		if (!stack.empty()) throw_omf_error("bad omf expression");
+		return t;
+	}
+
+	void omf_decoder::apply(const fixup &f) {
+
+		term t = evaluate(f.expr, f.expr_size, f.segment, f.offset);
+
+		if (f.relative) {
+			// only within the segment, where the distance is known.
+			if (t.sym) {
+				if (t.shift || !in_segment(t.sym) || symbol(t.sym).shndx != f.segment)
+					throw_omf_error("omf relative expression outside the segment");
+				t.value += symbol(t.sym).value;
+				t.sym = 0;
+			}
+			t.value -= f.origin;
+		}
+
+		if (!t.sym) {
+			auto &out = _obj->data[f.segment];
+			uint32_t value = t.value;
+			for (unsigned i = 0; i < f.size; ++i, value >>= 8)
+				out[f.offset + i] = value & 0xff;
+			return;
+		}
+
+		// elf relocation types with this size and shift (see abs_reloc).
+		// 16 and 17, for #>label and #^label, are elf2omf's own.
+		unsigned type = 0;
+		switch (f.size << 8 | t.shift) {
+			case 1 << 8 | 0: type = 11; break;
+			case 2 << 8 | 0: type = 2; break;
+			case 3 << 8 | 0: type = 3; break;
+			case 4 << 8 | 0: type = 4; break;
+			case 2 << 8 | 8: type = 12; break;
+			case 2 << 8 | 16: type = 15; break;
+			case 1 << 8 | 8: type = 16; break;
+			case 1 << 8 | 16: type = 17; break;
+			default: throw_omf_error("unsupported omf expression");
+		}
+		_obj->rela[f.segment].push_back(Elf32_Rela{ f.offset, ELF32_R_INFO((uint32_t)t.sym, type), (Elf32_Sword)t.value });
+	}
+
+	std::shared_ptr<omf_object> omf_decoder::decode(const uint8_t *data, size_t size) {
+
+		_obj = std::make_shared<omf_object>();
+		_obj->sections.emplace_back();
+		_obj->data.emplace_back();
+		_locals.emplace_back();
+
+		size_t offset = 0;
+		while (offset < size) {
+			segment_header h;
+			if (!read_header(data + offset, size - offset, h)) {
+				// trailing padding.
+				if (std::all_of(data + offset, data + size, [](uint8_t x){ return x == 0; })) break;
+				throw_omf_error();
+			}
+			_headers.push_back(h);
+			read_segment(data + offset, h);
+			offset += h.size;
+		}
+		if (_headers.empty()) throw_omf_error();
+
+		define_labels();
+
+		_obj->rela.resize(_obj->sections.size());
+		for (const auto &f : _fixups) apply(f);
+
+		// the views.
+		for (size_t i = 1; i < _obj->sections.size(); ++i) {
+			auto &is = _obj->sections[i];
+			const auto &d = _obj->data[i];
+			is.data = view<uint8_t>(d.data(), d.size());
+
+			const auto &r = _obj->rela[i];
+			if (r.empty()) continue;
+			auto &ir = _obj->relocs.emplace_back();
+			ir.section = i;
+			ir.relocs = reloc_cursor(r.data(), r.size());
+		}
+
+		return std::move(_obj);
+	}
+}
+
+
+bool is_omf(const uint8_t *data, size_t size) {
+	segment_header h;
+	return read_header(data, size, h);
+}
+
+bool is_omf_library(const uint8_t *data, size_t size) {
+	segment_header h;
+	return read_header(data, size, h) && (h.kind & 0x1f) == KIND_DICTIONARY;
+}
+
+std::shared_ptr<omf_object> read_omf_object(const uint8_t *data, size_t size) {
+	omf_decoder decoder;
+	return decoder.decode(data, size);
+}
+
+
+omf_library::omf_library(int fd, const std::string &name) : _name(name) {
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) throw_errno("fstat");
+	if (!S_ISREG(st.st_mode)) throw_omf_error("not a regular file");
+
+	_size = st.st_size;
+	if (!_size) throw_omf_error("not an ar archive or omf library");
+
+	void *vp = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (vp == MAP_FAILED) throw_errno("mmap");
+	size_t size = _size;
+	_map = std::shared_ptr<uint8_t>((uint8_t *)vp, [size](uint8_t *p){ munmap(p, size); });
+
+	if (!is_omf_library(_map.get(), _size)) throw_omf_error("not an ar archive or omf library");
+
+	read_dictionary();
+}
+
+// the dictionary is three LCONST records: the file names (file number,
+// name), the symbols (name offset, file number, private flag, segment
+// offset) and the symbol names.
+void omf_library::read_dictionary() {
+
+	const uint8_t *base = _map.get();
+	segment_header h;
+	read_header(base, _size, h);
+
+	std::vector<std::pair<const uint8_t *, uint32_t>> records;
+	record_reader in(base + h.body, base + h.size, h);
+	while (!in.at_end() && records.size() < 3) {
+		uint8_t op = in.byte();
+		if (op == 0x00) break;
+		if (op != 0xf2) throw_omf_error("bad omf library dictionary");
+		uint32_t n = in.number();
+		records.emplace_back(in.bytes(n), n);
+	}
+	if (records.size() != 3) throw_omf_error("bad omf library dictionary");
+
+	auto pstring = [](const uint8_t *p, uint32_t size, uint32_t offset){
+		if (offset >= size || p[offset] > size - offset - 1) throw_omf_error("bad omf library dictionary");
+		return std::string_view((const char *)p + offset + 1, p[offset]);
+	};
+
+	std::unordered_map<unsigned, std::string> files;
+	{
+		const auto &r = records[0];
+		uint32_t offset = 0;
+		while (offset + 2 < r.second) {
+			unsigned file = read16(r.first + offset);
+			auto name = pstring(r.first, r.second, offset + 2);
+			offset += 3 + name.size();
+			files.emplace(file, name);
+		}
+	}
+
+	// a member runs from its file's first segment to the next file's.
+	std::map<uint32_t, unsigned> starts;
+	std::unordered_map<unsigned, uint32_t> first;
+	std::vector<std::pair<std::string_view, unsigned>> symbols;
+	{
+		const auto &r = records[1];
+		for (uint32_t offset = 0; offset + 12 <= r.second; offset += 12) {
+			const uint8_t *p = r.first + offset;
+			unsigned file = read16(p + 4);
+			bool private_symbol = read16(p + 6);
+			uint32_t segment = read32(p + 8);
+			if (!segment || segment >= _size) throw_omf_error("bad omf library dictionary");
+
+			auto iter = first.find(file);
+			if (iter == first.end()) first.emplace(file, segment);
+			else iter->second = std::min(iter->second, segment);
+
+			if (!private_symbol)
+				symbols.emplace_back(pstring(records[2].first, records[2].second, read32(p)), file);
+		}
+	}
+
+	for (const auto &kv : first) starts.emplace(kv.second, kv.first);
+	for (auto iter = starts.begin(); iter != starts.end(); ++iter) {
+		auto next = std::next(iter);
+		auto &m = _members[iter->first];
+		m.size = (next == starts.end() ? _size : next->first) - iter->first;
+		auto f = files.find(iter->second);
+		m.name = f != files.end() ? f->second : std::to_string(iter->second);
+	}
+
+	for (const auto &s : symbols)
+		_index.emplace(s.first, first[s.second]);
+}
+
+uint32_t omf_library::find(std::string_view symbol) const {
+	auto iter = _index.find(symbol);
+	return iter == _index.end() ? 0 : iter->second;
+}
+
+std::string omf_library::member_name(uint32_t offset) const {
+	auto iter = _members.find(offset);
+	return iter == _members.end() ? std::to_string(offset) : iter->second.name;
+}
+
+const uint8_t *omf_library::member_data(uint32_t offset, size_t &size) const {
+	auto iter = _members.find(offset);
+	if (iter == _members.end()) {
+		size = 0;
+		return nullptr;
+	}
+	size = iter->second.size;
+	return _map.get() + offset;
+}
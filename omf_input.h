@@ -0,0 +1,100 @@
+#ifndef __omf_input_h__
+#define __omf_input_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "elf32.h"
+#include "input.h"
+
+/*
+ * OMF object files and libraries (ORCA/M, Merlin 16+, etc) as link inputs.
+ *
+ * An object file's segments are decoded, one record at a time, into the
+ * same sections, symbols and relocations as an elf object so the merge
+ * doesn't care where they came from:
+ *
+ *	code segments      -> "code"
+ *	data segments      -> "data"
+ *	dp/stack segments  -> "stack" (bss)
+ *
+ * GLOBAL and GEQU labels are global symbols (local if marked private);
+ * LOCAL and EQU labels are local symbols.  Expressions must reduce to a
+ * label plus a constant, optionally shifted right 8 or 16 bits, or to a
+ * constant.  RELEXPR only works within a segment.
+ */
+
+// the decoded object.  sections[0] is unused, as in elf; the other
+// sections are the segments, in order.  Section 1 onwards each have an
+// unnamed local (section) symbol.
+struct omf_object {
+	std::vector<input_section> sections;
+	std::vector<input_symbol> symbols;
+	std::vector<input_relocs> relocs;
+
+	// storage for the views above.
+	std::vector<std::vector<uint8_t>> data;
+	std::vector<std::vector<Elf32_Rela>> rela;
+	std::deque<std::string> names;
+};
+
+// the first segment header looks like an OMF (version 1 or 2) segment.
+bool is_omf(const uint8_t *data, size_t size);
+
+// true if the first segment is a library dictionary.
+bool is_omf_library(const uint8_t *data, size_t size);
+
+// throws std::runtime_error if the file can't be decoded.
+std::shared_ptr<omf_object> read_omf_object(const uint8_t *data, size_t size);
+
+
+/*
+ * OMF library (filetype $B2).  The first segment is the dictionary, which
+ * lists the object files, the global symbols and the offset of the
+ * segment defining each one.  A member is the run of segments from one
+ * object file, loaded when it defines an undefined symbol.
+ */
+class omf_library {
+
+	std::shared_ptr<uint8_t> _map;
+	size_t _size = 0;
+	std::string _name;
+
+	// symbol (in the mapped dictionary) -> offset of the member's first segment.
+	std::unordered_map<std::string_view, uint32_t> _index;
+
+	struct member {
+		std::string name;
+		uint32_t size = 0;
+	};
+	std::unordered_map<uint32_t, member> _members;
+
+	void read_dictionary();
+
+public:
+
+	// fd may be closed once the constructor returns.
+	omf_library(int fd, const std::string &name);
+
+	omf_library(const omf_library &) = delete;
+	omf_library &operator=(const omf_library &) = delete;
+
+	const std::string &name() const { return _name; }
+
+	// offset of the member that defines symbol, or 0.
+	uint32_t find(std::string_view symbol) const;
+
+	// name of the object file the member came from (for diagnostics).
+	std::string member_name(uint32_t offset) const;
+
+	// the member's segments, valid as long as the library.
+	const uint8_t *member_data(uint32_t offset, size_t &size) const;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __scratch_pool_h__
+#define __scratch_pool_h__
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+struct scratch_stats {
+	std::atomic<unsigned> requests{0};
+	std::atomic<unsigned> reused{0}; // requests satisfied without allocating
+};
+
+
+// hands out vectors which keep their capacity from one file to the next.
+template<class T>
+class scratch_pool {
+
+	std::mutex _mutex;
+	std::vector<std::vector<T>> _free;
+	scratch_stats &_stats;
+
+public:
+
+	explicit scratch_pool(scratch_stats &stats) : _stats(stats) {}
+
+	scratch_pool(const scratch_pool &) = delete;
+	scratch_pool &operator=(const scratch_pool &) = delete;
+
+	// returns an empty vector with room for at least size elements.
+	std::vector<T> acquire(size_t size) {
+		std::vector<T> rv;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_free.empty()) {
+				rv = std::move(_free.back());
+				_free.pop_back();
+			}
+		}
+
+		if (size) {
+			++_stats.requests;
+			if (rv.capacity() >= size) ++_stats.reused;
+			else rv.reserve(size);
+		}
+		return rv;
+	}
+
+	void release(std::vector<T> &v) {
+		v.clear();
+		if (!v.capacity()) return;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_free.emplace_back(std::move(v));
+		v = std::vector<T>();
+	}
+};
+
+#endif
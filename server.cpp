@@ -0,0 +1,210 @@
+#include "server.h"
+
+#include <stdexcept>
+#include <system_error>
+
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+static const uint32_t max_request = 1 << 20;
+
+// seconds a client has to send its request.  Requests are read one at a
+// time, so a client which connects and stalls would hold up every other.
+static const int request_timeout = 5;
+
+
+static bool make_address(const std::string &path, sockaddr_un &addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) return false;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+static bool read_all(int fd, void *vp, size_t size) {
+	uint8_t *p = (uint8_t *)vp;
+	while (size) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void *vp, size_t size) {
+	const uint8_t *p = (const uint8_t *)vp;
+	while (size) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+
+link_request::~link_request() {
+	if (fd >= 0) close(fd);
+	for (int x : stdio)
+		if (x >= 0) close(x);
+}
+
+
+link_server::link_server(const std::string &path) : _path(path) {
+
+	sockaddr_un addr;
+	if (!make_address(path, addr)) throw std::runtime_error(path + ": path too long");
+
+	_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (_fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+
+	// a stale socket from a server that's no longer running.
+	if (connect(_fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+		close(_fd);
+		throw std::runtime_error(path + ": a server is already running");
+	}
+	unlink(path.c_str());
+
+	if (bind(_fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(_fd, 16) < 0) {
+		int e = errno;
+		close(_fd);
+		throw std::system_error(e, std::generic_category(), path);
+	}
+}
+
+link_server::~link_server() {
+	if (_fd >= 0) {
+		close(_fd);
+		unlink(_path.c_str());
+	}
+}
+
+bool link_server::accept(link_request &request) {
+
+	int fd;
+	do {
+		fd = ::accept(_fd, nullptr, nullptr);
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0) throw std::system_error(errno, std::generic_category(), "accept");
+
+	request.fd = fd;
+
+	timeval tv = { request_timeout, 0 };
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) return false;
+
+	// the size, with the client's stdin/stdout/stderr attached.
+	uint32_t size = 0;
+	iovec iov = { &size, sizeof(size) };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)];
+
+	msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t n;
+	do {
+		n = recvmsg(fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n != sizeof(size)) return false;
+
+	for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+		if (c->cmsg_len != CMSG_LEN(sizeof(int) * 3)) continue;
+		memcpy(request.stdio, CMSG_DATA(c), sizeof(int) * 3);
+	}
+	if (request.stdio[2] < 0) return false;
+	if (size == 0 || size > max_request) return false;
+
+	// cwd \0 argv[0] \0 argv[1] \0 ...
+	std::string buffer(size, 0);
+	if (!read_all(fd, &buffer[0], size)) return false;
+	if (buffer.back() != 0) return false;
+
+	size_t pos = buffer.find('\0');
+	request.cwd = buffer.substr(0, pos);
+	for (++pos; pos < buffer.size(); ) {
+		size_t end = buffer.find('\0', pos);
+		request.args.emplace_back(buffer.substr(pos, end - pos));
+		pos = end + 1;
+	}
+	return !request.args.empty();
+}
+
+void link_server::reply(link_request &request, int status) {
+	int32_t tmp = status;
+	write_all(request.fd, &tmp, sizeof(tmp));
+}
+
+
+int client_link(const std::string &path, int argc, char **argv) {
+
+	sockaddr_un addr;
+	if (!make_address(path, addr)) return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) {
+		close(fd);
+		return -1;
+	}
+
+	std::string buffer = cwd;
+	buffer.push_back(0);
+	for (int i = 0; i < argc; ++i) {
+		buffer.append(argv[i]);
+		buffer.push_back(0);
+	}
+
+	uint32_t size = buffer.size();
+	iovec iov = { &size, sizeof(size) };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)] = {};
+	int stdio[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+	msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(stdio));
+	memcpy(CMSG_DATA(c), stdio, sizeof(stdio));
+
+	ssize_t n;
+	do {
+		n = sendmsg(fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+
+	// once the request is sent, the server owns the link.  If it goes away
+	// before replying, report a failure rather than linking twice.
+	int32_t status = 1;
+	if (n != sizeof(size) || !write_all(fd, buffer.data(), buffer.size())) {
+		close(fd);
+		return -1;
+	}
+	if (!read_all(fd, &status, sizeof(status))) status = 1;
+	close(fd);
+	return status;
+}
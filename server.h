@@ -0,0 +1,50 @@
+#ifndef __server_h__
+#define __server_h__
+
+#include <string>
+#include <vector>
+
+/*
+ * Local socket transport for the resident link server (-s).  A client
+ * sends its working directory, argv and stdin/stdout/stderr; the server
+ * replies with the link's exit status once it's done.
+ */
+
+struct link_request {
+	int fd = -1; // connection, for the reply
+	std::string cwd;
+	std::vector<std::string> args;
+	int stdio[3] = { -1, -1, -1 };
+
+	link_request() = default;
+	link_request(const link_request &) = delete;
+	link_request &operator=(const link_request &) = delete;
+	~link_request();
+};
+
+class link_server {
+
+	int _fd = -1;
+	std::string _path;
+
+public:
+
+	// throws if the socket can't be created.
+	explicit link_server(const std::string &path);
+	~link_server();
+
+	link_server(const link_server &) = delete;
+	link_server &operator=(const link_server &) = delete;
+
+	// wait for the next request.  Returns false if a bad request was
+	// received (the caller should just try again).
+	bool accept(link_request &request);
+
+	static void reply(link_request &request, int status);
+};
+
+// forward argv to a server.  Returns the exit status, or -1 if there's no
+// server listening at path.
+int client_link(const std::string &path, int argc, char **argv);
+
+#endif
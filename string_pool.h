@@ -0,0 +1,69 @@
+#ifndef __string_pool_h__
+#define __string_pool_h__
+
+#include <stddef.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+
+// a name and its hash, computed once.  Used as the key of the symbol and
+// section maps so neither a lookup nor a rehash hashes the string again.
+struct hashed_name {
+	std::string_view name;
+	size_t hash = 0;
+
+	hashed_name() = default;
+	explicit hashed_name(std::string_view name) :
+		name(name), hash(std::hash<std::string_view>()(name))
+	{}
+
+	bool operator==(const hashed_name &rhs) const {
+		return hash == rhs.hash && name == rhs.name;
+	}
+};
+
+struct hashed_name_hash {
+	size_t operator()(const hashed_name &x) const { return x.hash; }
+};
+
+
+// storage for names which last as long as the link.  Each one is copied
+// once, into large blocks, and never moves.  Not thread safe.
+class string_pool {
+
+	static constexpr size_t block_size = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> _blocks;
+	char *_next = nullptr;
+	size_t _free = 0;
+
+public:
+
+	string_pool() = default;
+
+	string_pool(const string_pool &) = delete;
+	string_pool &operator=(const string_pool &) = delete;
+
+	std::string_view copy(std::string_view s) {
+		if (s.empty()) return std::string_view();
+
+		if (s.size() > _free) {
+			size_t size = std::max(block_size, s.size());
+			_blocks.emplace_back(new char[size]);
+			_next = _blocks.back().get();
+			_free = size;
+		}
+
+		memcpy(_next, s.data(), s.size());
+		std::string_view rv(_next, s.size());
+		_next += s.size();
+		_free -= s.size();
+		return rv;
+	}
+};
+
+#endif
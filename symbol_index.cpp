@@ -0,0 +1,379 @@
+#include "symbol_index.h"
+#include "elf_file.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ * File layout (native byte order; the magic doubles as a byte order mark):
+ *
+ *   header
+ *   file_entry[files]
+ *   uint64_t bloom[bloom_words]
+ *   uint32_t displacements[buckets]
+ *   slot[symbols]
+ *   char strings[strings_size]
+ */
+
+static const char index_magic[8] = { 'E', '2', 'O', 'I', 'D', 'X', 0, 1 };
+static const uint32_t index_version = 1;
+static const uint32_t index_bom = 0x01020304;
+
+struct symbol_index::header {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t files;
+	uint32_t symbols;
+	uint32_t bloom_words;
+	uint32_t buckets;
+	uint32_t strings_size;
+	uint32_t reserved;
+};
+
+struct symbol_index::file_entry {
+	uint32_t name;
+	uint32_t name_size;
+	uint64_t size;
+	int64_t sec;
+	int64_t nsec;
+};
+
+struct symbol_index::slot {
+	uint32_t name;
+	uint32_t name_size;
+	uint32_t file;
+	uint32_t reserved;
+};
+
+static void throw_index_error(const std::string &msg = "invalid symbol index") {
+	throw std::runtime_error(msg);
+}
+
+static const unsigned bloom_hashes = 6;
+static const unsigned bloom_bits_per_symbol = 10;
+
+
+// fnv-1a, then a final mix since the low bits are used directly.
+static uint64_t hash_string(std::string_view s) {
+	uint64_t h = 0xcbf29ce484222325;
+	for (unsigned char c : s) {
+		h ^= c;
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccd;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint32_t bucket_of(uint64_t h, uint32_t buckets) {
+	return mix(h) % buckets;
+}
+
+static uint32_t slot_of(uint64_t h, uint32_t displacement, uint32_t symbols) {
+	return mix(h ^ (displacement * 0x9e3779b97f4a7c15)) % symbols;
+}
+
+static void bloom_add(uint64_t *bloom, uint32_t words, uint64_t h) {
+	uint64_t bits = (uint64_t)words * 64;
+	uint32_t h1 = h;
+	uint32_t h2 = (h >> 32) | 1;
+	for (unsigned i = 0; i < bloom_hashes; ++i) {
+		uint64_t bit = (h1 + (uint64_t)i * h2) % bits;
+		bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+	}
+}
+
+static bool bloom_test(const uint64_t *bloom, uint32_t words, uint64_t h) {
+	uint64_t bits = (uint64_t)words * 64;
+	uint32_t h1 = h;
+	uint32_t h2 = (h >> 32) | 1;
+	for (unsigned i = 0; i < bloom_hashes; ++i) {
+		uint64_t bit = (h1 + (uint64_t)i * h2) % bits;
+		if (!(bloom[bit / 64] & ((uint64_t)1 << (bit % 64)))) return false;
+	}
+	return true;
+}
+
+
+symbol_index::stamp symbol_index::make_stamp(const struct stat &st) {
+	stamp rv;
+	rv.size = st.st_size;
+#if defined(__APPLE__)
+	rv.sec = st.st_mtimespec.tv_sec;
+	rv.nsec = st.st_mtimespec.tv_nsec;
+#else
+	rv.sec = st.st_mtim.tv_sec;
+	rv.nsec = st.st_mtim.tv_nsec;
+#endif
+	return rv;
+}
+
+std::string symbol_index::index_path(const std::string &dir) {
+	std::string rv = dir;
+	if (!rv.empty() && rv.back() != '/') rv.push_back('/');
+	return rv + "elf2omf.index";
+}
+
+
+size_t symbol_index::write(const std::string &path, const std::vector<file> &files) {
+
+	std::string strings;
+	std::unordered_map<std::string_view, size_t> seen;
+
+	struct entry {
+		uint64_t hash;
+		uint32_t name;
+		uint32_t name_size;
+		uint32_t file;
+	};
+	std::vector<entry> entries;
+
+	std::vector<file_entry> file_table;
+	file_table.reserve(files.size());
+
+	for (const auto &f : files) {
+		auto &fe = file_table.emplace_back();
+		fe.name = strings.size();
+		fe.name_size = f.name.size();
+		fe.size = f.st.size;
+		fe.sec = f.st.sec;
+		fe.nsec = f.st.nsec;
+		strings.append(f.name);
+		strings.push_back(0);
+	}
+
+	for (size_t i = 0; i < files.size(); ++i) {
+		for (const auto &name : files[i].symbols) {
+			if (seen.count(name)) continue; // first definition wins
+			seen.emplace(name, i);
+
+			auto &e = entries.emplace_back();
+			e.hash = hash_string(name);
+			e.name = strings.size();
+			e.name_size = name.size();
+			e.file = i;
+			strings.append(name);
+			strings.push_back(0);
+		}
+	}
+	if (strings.size() > UINT32_MAX) throw_index_error("symbol index too large");
+
+	uint32_t symbols = entries.size();
+	uint32_t buckets = std::max<uint32_t>(1, symbols / 4);
+	uint32_t bloom_words = std::max<uint32_t>(1, (symbols * bloom_bits_per_symbol + 63) / 64);
+
+	std::vector<uint64_t> bloom(bloom_words);
+	for (const auto &e : entries) bloom_add(bloom.data(), bloom_words, e.hash);
+
+	// hash and displace: place the largest buckets first, searching for a
+	// displacement which puts every key in the bucket into an empty slot.
+	std::vector<std::vector<uint32_t>> bucket_keys(buckets);
+	for (uint32_t i = 0; i < symbols; ++i)
+		bucket_keys[bucket_of(entries[i].hash, buckets)].push_back(i);
+
+	std::vector<uint32_t> order(buckets);
+	for (uint32_t i = 0; i < buckets; ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+		return bucket_keys[a].size() > bucket_keys[b].size();
+	});
+
+	std::vector<uint32_t> displacements(buckets);
+	std::vector<slot> slots(symbols);
+	std::vector<bool> used(symbols);
+	std::vector<uint32_t> tmp;
+
+	for (uint32_t b : order) {
+		const auto &keys = bucket_keys[b];
+		if (keys.empty()) break;
+
+		for (uint32_t d = 0; ; ++d) {
+			if (d == UINT32_MAX) throw_index_error("unable to build perfect hash");
+
+			tmp.clear();
+			bool ok = true;
+			for (uint32_t k : keys) {
+				uint32_t s = slot_of(entries[k].hash, d, symbols);
+				if (used[s] || std::find(tmp.begin(), tmp.end(), s) != tmp.end()) {
+					ok = false;
+					break;
+				}
+				tmp.push_back(s);
+			}
+			if (!ok) continue;
+
+			displacements[b] = d;
+			for (size_t i = 0; i < keys.size(); ++i) {
+				const auto &e = entries[keys[i]];
+				used[tmp[i]] = true;
+				slots[tmp[i]] = slot{ e.name, e.name_size, e.file, 0 };
+			}
+			break;
+		}
+	}
+
+	header h = {};
+	memcpy(h.magic, index_magic, sizeof(h.magic));
+	h.version = index_version;
+	h.bom = index_bom;
+	h.files = file_table.size();
+	h.symbols = symbols;
+	h.bloom_words = bloom_words;
+	h.buckets = buckets;
+	h.strings_size = strings.size();
+
+	// write to a temporary and rename so readers never see a partial index.
+	std::string tmp_path = path + ".tmp";
+	FILE *fp = fopen(tmp_path.c_str(), "wb");
+	if (!fp) throw_errno(tmp_path);
+
+	bool ok = true;
+	ok &= fwrite(&h, sizeof(h), 1, fp) == 1;
+	ok &= fwrite(file_table.data(), sizeof(file_entry), file_table.size(), fp) == file_table.size();
+	ok &= fwrite(bloom.data(), sizeof(uint64_t), bloom.size(), fp) == bloom.size();
+	ok &= fwrite(displacements.data(), sizeof(uint32_t), displacements.size(), fp) == displacements.size();
+	ok &= fwrite(slots.data(), sizeof(slot), slots.size(), fp) == slots.size();
+	ok &= fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+	ok &= fclose(fp) == 0;
+
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) < 0) {
+		int e = errno;
+		unlink(tmp_path.c_str());
+		errno = e;
+		throw_errno(path);
+	}
+	return symbols;
+}
+
+
+symbol_index::symbol_index(const std::string &dir) : _dir(dir) {
+
+	std::string path = index_path(dir);
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw_errno(path);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		throw_errno(path);
+	}
+
+	_size = st.st_size;
+	void *vp = _size ? mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (vp == MAP_FAILED) throw_index_error(path + ": invalid symbol index");
+
+	size_t size = _size;
+	_map = std::shared_ptr<uint8_t>((uint8_t *)vp, [size](uint8_t *p){ munmap(p, size); });
+
+	const uint8_t *base = _map.get();
+	if (_size < sizeof(header)) throw_index_error(path + ": invalid symbol index");
+
+	_header = (const header *)base;
+	if (memcmp(_header->magic, index_magic, sizeof(index_magic)) || _header->bom != index_bom)
+		throw_index_error(path + ": invalid symbol index");
+	if (_header->version != index_version)
+		throw_index_error(path + ": unsupported symbol index version");
+
+	const auto &h = *_header;
+	if (!h.bloom_words || !h.buckets) throw_index_error(path + ": invalid symbol index");
+
+	uint64_t offset = sizeof(header);
+	uint64_t expected = offset
+		+ (uint64_t)h.files * sizeof(file_entry)
+		+ (uint64_t)h.bloom_words * sizeof(uint64_t)
+		+ (uint64_t)h.buckets * sizeof(uint32_t)
+		+ (uint64_t)h.symbols * sizeof(slot)
+		+ h.strings_size;
+	if (expected != _size) throw_index_error(path + ": invalid symbol index");
+
+	_files = (const file_entry *)(base + offset);
+	offset += (uint64_t)h.files * sizeof(file_entry);
+	_bloom = (const uint64_t *)(base + offset);
+	offset += (uint64_t)h.bloom_words * sizeof(uint64_t);
+	_displacements = (const uint32_t *)(base + offset);
+	offset += (uint64_t)h.buckets * sizeof(uint32_t);
+	_slots = (const slot *)(base + offset);
+	offset += (uint64_t)h.symbols * sizeof(slot);
+	_strings = (const char *)(base + offset);
+}
+
+
+std::string_view symbol_index::string(uint32_t offset, uint32_t length) const {
+	if (offset > _header->strings_size || length > _header->strings_size - offset)
+		return std::string_view();
+	return std::string_view(_strings + offset, length);
+}
+
+int symbol_index::find(std::string_view symbol) const {
+
+	const auto &h = *_header;
+	if (!h.symbols) return -1;
+
+	uint64_t hash = hash_string(symbol);
+	if (!bloom_test(_bloom, h.bloom_words, hash)) return -1;
+
+	uint32_t d = _displacements[bucket_of(hash, h.buckets)];
+	const auto &s = _slots[slot_of(hash, d, h.symbols)];
+
+	if (s.file >= h.files) return -1;
+	if (string(s.name, s.name_size) != symbol) return -1;
+	return s.file;
+}
+
+std::string symbol_index::path(unsigned n) const {
+	std::string rv = _dir;
+	if (!rv.empty() && rv.back() != '/') rv.push_back('/');
+	if (n < _header->files) {
+		const auto &f = _files[n];
+		rv.append(string(f.name, f.name_size));
+	}
+	return rv;
+}
+
+int symbol_index::open(unsigned n) const {
+
+	if (n >= _header->files) throw_index_error("invalid symbol index");
+
+	std::string p = path(n);
+	int fd = ::open(p.c_str(), O_RDONLY);
+	if (fd < 0) throw_errno(p);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int e = errno;
+		close(fd);
+		errno = e;
+		throw_errno(p);
+	}
+
+	const auto &f = _files[n];
+	stamp expected;
+	expected.size = f.size;
+	expected.sec = f.sec;
+	expected.nsec = f.nsec;
+	if (make_stamp(st) != expected) {
+		close(fd);
+		throw_index_error("changed since the symbol index was built (rebuild with -I " + _dir + ")");
+	}
+	return fd;
+}
@@ -0,0 +1,90 @@
+#ifndef __symbol_index_h__
+#define __symbol_index_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct stat;
+
+/*
+ * Prebuilt index of a directory of objects: defined global symbol ->
+ * object file.  The index file is mapped as-is; lookups go through a
+ * bloom filter, then a perfect hash (hash and displace), so a symbol
+ * that isn't there usually costs no more than a couple of cache lines.
+ *
+ * Each object's size and mtime are recorded so stale entries are
+ * detected when the object is opened.
+ */
+class symbol_index {
+
+public:
+
+	struct stamp {
+		uint64_t size = 0;
+		int64_t sec = 0;
+		int64_t nsec = 0;
+
+		bool operator==(const stamp &rhs) const {
+			return size == rhs.size && sec == rhs.sec && nsec == rhs.nsec;
+		}
+		bool operator!=(const stamp &rhs) const { return !(*this == rhs); }
+	};
+
+	struct file {
+		std::string name; // relative to the directory
+		stamp st;
+		std::vector<std::string> symbols;
+	};
+
+	static stamp make_stamp(const struct stat &st);
+
+	// name of the index file within dir.
+	static std::string index_path(const std::string &dir);
+
+	// write an index.  If a symbol is defined more than once, the first
+	// file wins.  Returns the number of symbols indexed.
+	static size_t write(const std::string &path, const std::vector<file> &files);
+
+	// open dir's index.  Throws if it's missing or invalid.
+	explicit symbol_index(const std::string &dir);
+
+	symbol_index(const symbol_index &) = delete;
+	symbol_index &operator=(const symbol_index &) = delete;
+
+	const std::string &directory() const { return _dir; }
+
+	// file number that defines symbol, or -1.
+	int find(std::string_view symbol) const;
+
+	// path of file number n.
+	std::string path(unsigned n) const;
+
+	// open file number n and verify it hasn't changed since the index was built.
+	// Returns the fd; throws if it can't be opened or is out of date.
+	int open(unsigned n) const;
+
+private:
+
+	struct header;
+	struct file_entry;
+	struct slot;
+
+	std::string _dir;
+	std::shared_ptr<uint8_t> _map;
+	size_t _size = 0;
+
+	const header *_header = nullptr;
+	const file_entry *_files = nullptr;
+	const uint64_t *_bloom = nullptr;
+	const uint32_t *_displacements = nullptr;
+	const slot *_slots = nullptr;
+	const char *_strings = nullptr;
+
+	std::string_view string(uint32_t offset, uint32_t length) const;
+};
+
+#endif
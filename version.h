@@ -0,0 +1,7 @@
+#ifndef __version_h__
+#define __version_h__
+
+// bump when the output or any cached format changes.
+#define ELF2OMF_VERSION "0.3"
+
+#endif
@@ -0,0 +1,195 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+
+	/*
+	 * GNU make jobserver client.  make -jN hands its children a pipe (or,
+	 * since make 4.4, a named fifo) holding N-1 tokens; a child already owns
+	 * one implicit job slot and must read a token for each additional one,
+	 * writing the same byte back when it's done with it.
+	 *
+	 * MAKEFLAGS has --jobserver-auth=R,W (--jobserver-fds=R,W before make
+	 * 4.2) or --jobserver-auth=fifo:PATH.  Tokens are only ever taken
+	 * without blocking, so a busy make just means fewer threads.
+	 */
+	class jobserver {
+
+		int _read = -1;
+		int _write = -1;
+		bool _make = false;
+
+		static std::string auth(const char *flags);
+
+	public:
+		jobserver();
+		~jobserver();
+
+		jobserver(const jobserver &) = delete;
+		jobserver &operator=(const jobserver &) = delete;
+
+		// running under make (with or without a usable jobserver).
+		bool make() const { return _make; }
+		bool active() const { return _read >= 0; }
+
+		bool acquire(char &token);
+		void release(char token);
+	};
+
+	// the last --jobserver-auth (or --jobserver-fds) wins.
+	std::string jobserver::auth(const char *flags) {
+
+		std::string s(flags);
+		std::string rv;
+		size_t pos = 0;
+		for(;;) {
+			pos = s.find("--jobserver-", pos);
+			if (pos == s.npos) break;
+			pos += 12;
+
+			size_t start;
+			if (s.compare(pos, 5, "auth=") == 0) start = pos + 5;
+			else if (s.compare(pos, 4, "fds=") == 0) start = pos + 4;
+			else continue;
+
+			size_t end = s.find(' ', start);
+			rv = s.substr(start, end == s.npos ? s.npos : end - start);
+		}
+		return rv;
+	}
+
+	jobserver::jobserver() {
+
+		// make sets MAKELEVEL for everything it runs.
+		_make = getenv("MAKELEVEL") != nullptr;
+
+		const char *flags = getenv("MAKEFLAGS");
+		if (!flags) return;
+
+		std::string value = auth(flags);
+		if (value.empty()) return;
+
+		if (value.compare(0, 5, "fifo:") == 0) {
+			int fd = open(value.c_str() + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+			if (fd < 0) return;
+			_read = _write = fd;
+			return;
+		}
+
+		int r, w;
+		if (sscanf(value.c_str(), "%d,%d", &r, &w) != 2) return;
+		if (r < 0 || w < 0) return;
+
+		// make closes the pipe for recipes it doesn't consider recursive.
+		if (fcntl(r, F_GETFD) < 0 || fcntl(w, F_GETFD) < 0) return;
+
+		// the read end is shared with make, which expects it to block, so
+		// reopen the pipe for a private non-blocking descriptor.
+		std::string path = "/proc/self/fd/" + std::to_string(r);
+		int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0) return;
+		_read = fd;
+		_write = w;
+	}
+
+	jobserver::~jobserver() {
+		// the pipe's write end belongs to make.
+		if (_read >= 0) close(_read);
+	}
+
+	bool jobserver::acquire(char &token) {
+		if (_read < 0) return false;
+		for(;;) {
+			ssize_t ok = read(_read, &token, 1);
+			if (ok == 1) return true;
+			if (ok < 0 && errno == EINTR) continue;
+			return false;
+		}
+	}
+
+	void jobserver::release(char token) {
+		for(;;) {
+			ssize_t ok = write(_write, &token, 1);
+			if (ok < 0 && errno == EINTR) continue;
+			return;
+		}
+	}
+
+	jobserver &the_jobserver() {
+		static jobserver js;
+		return js;
+	}
+}
+
+
+unsigned default_jobs() {
+	// under make without a jobserver (make without -j, or a recipe not
+	// marked recursive) stay on the one job slot make gave us.
+	const auto &js = the_jobserver();
+	if (js.make() && !js.active()) return 1;
+
+	unsigned n = std::thread::hardware_concurrency();
+	return n ? n : 1;
+}
+
+void parallel_for(unsigned jobs, size_t count, const std::function<void(size_t)> &fn) {
+
+	if (jobs > count) jobs = count;
+
+	// with a jobserver, each extra thread needs a token.
+	std::vector<char> tokens;
+	auto &js = the_jobserver();
+	if (jobs > 1 && js.active()) {
+		char t;
+		while (tokens.size() < jobs - 1 && js.acquire(t))
+			tokens.push_back(t);
+		jobs = tokens.size() + 1;
+	}
+
+	if (jobs <= 1) {
+		for (size_t i = 0; i < count; ++i) fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&](){
+		for(;;) {
+			size_t i = next++;
+			if (i >= count) break;
+			fn(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(jobs - 1);
+	for (unsigned i = 1; i < jobs; ++i) {
+		if (tokens.empty()) {
+			threads.emplace_back(worker);
+			continue;
+		}
+		// hand the token back as soon as the thread runs out of work.
+		char t = tokens[i - 1];
+		threads.emplace_back([&, t](){
+			worker();
+			js.release(t);
+		});
+	}
+
+	worker();
+
+	for (auto &t : threads) t.join();
+}
@@ -0,0 +1,19 @@
+#ifndef __worker_pool_h__
+#define __worker_pool_h__
+
+#include <stddef.h>
+#include <functional>
+
+// number of worker threads to use by default.  Under make without a
+// jobserver, this is 1.
+unsigned default_jobs();
+
+// call fn(0) ... fn(count - 1) on up to `jobs` threads (including the
+// calling thread) and wait for them to finish.  fn must not throw.
+//
+// Under a GNU make jobserver (MAKEFLAGS --jobserver-auth) each thread
+// beyond the calling one takes a token, if one is free, and returns it
+// when it runs out of work.
+void parallel_for(unsigned jobs, size_t count, const std::function<void(size_t)> &fn);
+
+#endif